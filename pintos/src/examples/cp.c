@@ -36,6 +36,8 @@ main (int argc, char *argv[])
       printf ("%s: open failed\n", argv[2]);
       return EXIT_FAILURE;
     }
+  /* Lay the copy out in one piece. */
+  preallocate (out_fd, filesize (in_fd));
 
   /* Copy data. */
   for (;;) 
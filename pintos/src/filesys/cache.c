@@ -1,14 +1,37 @@
 #include "filesys/cache.h"
+#include <debug.h>
 #include <list.h>
+#include <round.h>
+#include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
 #include "devices/timer.h"
 #include "filesys/filesys.h"
+#include "filesys/free-map.h"
 #include "threads/malloc.h"
+#include "threads/palloc.h"
 #include "threads/synch.h"
 #include "threads/thread.h"
+#include "threads/vaddr.h"
 
-#define BUFFER_CACHE_LIMIT 64
+/* Smallest buffer cache we accept. Every running thread may hold a
+ * few sectors at once, and eviction spins until one is released. */
+#define BUFFER_CACHE_MIN 16
+/* Maximum number of pending read ahead requests. Further requests are
+ * dropped until the read ahead daemon catches up. */
+#define READ_AHEAD_QUEUE 64
+/* Write behind starts early when more than 1 / WRITE_BEHIND_RATIO of
+ * the buffer cache is dirty. */
+#define WRITE_BEHIND_RATIO 2
+/* Largest number of shards of the buffer cache. */
+#define BUFFER_CACHE_SHARDS 16
+
+/* Queues of the 2Q replacement policy. */
+enum two_q_queue
+  {
+    TWO_Q_IN,                               /* Seen once recently. */
+    TWO_Q_MAIN                              /* Seen more than once. */
+  };
 
 /* Buffer cache element. */
 struct buf_elem
@@ -20,38 +43,106 @@ struct buf_elem
     bool is_ready;
     /* Set to true when it is removed. */
     bool is_removed;
+    /* Set to true when read ahead brings the sector in and cleared when
+     * somebody asks for it. Protected by the shard lock. */
+    bool is_read_ahead;
+    /* Set by the clock policy when the sector is accessed. */
+    bool is_referenced;
+    /* Queue of the 2Q policy the element is in. */
+    enum two_q_queue queue;
     /* Number of threads reading or writing this block. A cache element
      * can be evicted only if holders is 0. */
     int holders;
     struct lock mutex;                      /* Mutex for metadata. */
-    /* Mutex to avoid write race conditions. */
-    struct lock write_lock;
+    /* Latch on DATA. Readers hold it shared while copying out or
+     * writing back, and writers hold it exclusive while copying in. It
+     * is never acquired while holding MUTEX. */
+    struct rwlock latch;
     /* Condition variable to signal that data is completely copied from
      * disk. */
     struct condition data_ready;
     uint8_t data[DISK_SECTOR_SIZE];         /* Actual content. */
     struct list_elem elem;                  /* List element. */
+    struct list_elem index_elem;            /* Element in sector index. */
+    struct list_elem policy_elem;           /* Element in policy queue. */
   };
 
-/* Data structure for read ahead. */
-struct read_ahead_elem
+/* Shard of the buffer cache. Every sector belongs to exactly one shard,
+ * chosen by its sector number, and is cached only in one of the shard's
+ * own elements. Each shard has its own lock, sector index and
+ * replacement state, so threads working on sectors of different shards
+ * do not wait for each other. */
+struct cache_shard
   {
-    disk_sector_t sector;                   /* Sector to read. */
-    struct list_elem elem;                  /* List element. */
+    struct lock lock;                       /* Mutex for the shard. */
+    struct buf_elem * pool;                 /* Preallocated elements. */
+    size_t size;                            /* Number of elements. */
+    size_t cnt;                             /* Elements in use. */
+    struct list elems;                      /* Elements in use. */
+    /* Elements hashed by their sector numbers. Removed elements are not
+     * in the index. */
+    struct list * index;
+    size_t buckets;                         /* Always a power of 2. */
+    /* Replacement state. QUEUE is the clock ring, the LRU list or the
+     * main queue of 2Q, and the other members are used by the policy
+     * they are named after. */
+    struct list queue;
+    struct list_elem * clock_hand;          /* Next element to examine. */
+    struct list two_q_in;                   /* 2Q queue of new elements. */
+    size_t two_q_in_cnt;                    /* Elements in TWO_Q_IN. */
+    disk_sector_t * two_q_out;              /* 2Q ring of evicted sectors. */
+    size_t two_q_out_size;                  /* Capacity of TWO_Q_OUT. */
+    size_t two_q_out_head, two_q_out_cnt;   /* Oldest and count. */
+    /* Statistics of the shard. Write behind is counted elsewhere. */
+    struct cache_stats stats;
   };
 
-/* Number of buffer caches. */
-static unsigned int buffer_cache_cnt;
-/* Buffer cache list. */
-static struct list buffer_cache;
-/* Mutex for buffer cache list. */
-static struct lock buffer_cache_lock;
-/* Circular list head. */
-static struct list_elem * buffer_cache_curr;
-
-/* Read ahead list. */
-static struct list read_ahead;
-/* Mutex for read ahead list. */
+/* Replacement policy of the buffer cache. Every function works on a
+ * single shard and is called with the shard's lock held. */
+struct cache_policy
+  {
+    const char * name;                      /* Name on command line. */
+    /* Initializes the policy's state in a shard. */
+    void (* init) (struct cache_shard *);
+    /* Starts tracking an element that now holds a new sector. */
+    void (* insert) (struct cache_shard *, struct buf_elem *);
+    /* Notes that the element was looked up. */
+    void (* access) (struct cache_shard *, struct buf_elem *);
+    /* Notes that the element's sector was removed, so that it is
+     * evicted early. */
+    void (* demote) (struct cache_shard *, struct buf_elem *);
+    /* Chooses an element with no holders, stops tracking it and returns
+     * it with its mutex acquired. Returns NULL if every element is
+     * held. */
+    struct buf_elem * (* victim) (struct cache_shard *);
+  };
+
+/* Number of sectors the buffer cache can hold. Set by the -bc kernel
+ * command line option. */
+size_t buffer_cache_size = BUFFER_CACHE_DEFAULT;
+/* Preallocated buffer cache elements, BUFFER_CACHE_SIZE of them. */
+static struct buf_elem * buffer_cache_pool;
+/* Number of pages BUFFER_CACHE_POOL occupies. */
+static size_t buffer_cache_pages;
+/* Shards of the buffer cache. */
+static struct cache_shard buffer_cache_shards[BUFFER_CACHE_SHARDS];
+/* Number of shards in use. Always a power of 2. */
+static size_t buffer_cache_shard_cnt;
+/* Base 2 logarithm of BUFFER_CACHE_SHARD_CNT. */
+static unsigned buffer_cache_shard_bits;
+/* Name of the replacement policy. Set by the -bcp kernel command line
+ * option. */
+const char * buffer_cache_policy = "clock";
+/* Replacement policy in use. */
+static const struct cache_policy * policy;
+
+/* Circular queue of sectors to read ahead. */
+static disk_sector_t read_ahead_queue[READ_AHEAD_QUEUE];
+/* Index of the oldest request in READ_AHEAD_QUEUE. */
+static size_t read_ahead_head;
+/* Number of requests in READ_AHEAD_QUEUE. */
+static size_t read_ahead_cnt;
+/* Mutex for read ahead queue. */
 static struct lock read_ahead_lock;
 /* Conditional variable to signal read ahead daemon that there may be
  * some blocks to read. */
@@ -62,37 +153,124 @@ static bool is_read_ahead_done;
 /* To ensure read daemon has completed before pintos shutdowns. */
 static struct semaphore read_daemon_sema;
 
+/* Mutex for the write behind daemon's state and BUFFER_CACHE_DIRTY.
+ * No other lock is acquired while holding it. */
+static struct lock write_behind_lock;
 /* Set to true when filesys_done is called. Write behind daemon will
  * terminate. */
 static bool is_write_behind_done;
+/* Set to true when write behind is requested and cleared when the
+ * daemon starts a pass, so that no request is lost during a pass. */
+static bool is_write_behind_pending;
 /* Conditional variable to signal it is time to write behind. */
 static struct condition write_daemon_cond;
+/* Number of dirty buffer cache elements. */
+static size_t buffer_cache_dirty;
+/* Dirty elements collected by a write behind pass. */
+static struct buf_elem ** write_behind_batch;
 /* To ensure write daemon has completed before pintos shutdown. */
 static struct semaphore write_daemon_sema;
+/* Number of write behind passes. Protected by write_behind_lock. */
+static unsigned long long write_behind_flushes;
+/* Number of sectors written by them. Protected by write_behind_lock. */
+static unsigned long long write_behind_flushed;
 
 static void read_ahead_daemon (void * aux UNUSED);
 static void write_behind_daemon (void * aux UNUSED);
 static void timer_daemon (void * aux UNUSED);
-static struct buf_elem * buf_elem_init (disk_sector_t sector, bool hold);
+static struct buf_elem * buf_elem_init (struct cache_shard * shard,
+                                        disk_sector_t sector, bool hold,
+                                        bool ahead);
 static void buffer_cache_epilogue (struct buf_elem * target);
-static struct buf_elem * buffer_cache_evict (disk_sector_t sector, bool hold);
-static struct buf_elem * buffer_cache_find (disk_sector_t sector, bool hold);
+static struct buf_elem * buffer_cache_evict (struct cache_shard * shard,
+                                             disk_sector_t sector, bool hold,
+                                             bool ahead);
+static struct buf_elem * buffer_cache_find (disk_sector_t sector, bool hold,
+                                            bool fill);
+static void buffer_cache_prefetch (disk_sector_t sector);
+static struct cache_shard * buffer_cache_shard (disk_sector_t sector);
+static struct list * buffer_cache_bucket (struct cache_shard * shard,
+                                          disk_sector_t sector);
+static struct buf_elem * buffer_cache_lookup (struct cache_shard * shard,
+                                              disk_sector_t sector);
+static void buffer_cache_set_dirty (struct buf_elem * target, bool dirty);
+static void buffer_cache_flush (void);
+static void write_behind_request (void);
+static const struct cache_policy * policy_find (const char * name);
 
 void
 buffer_cache_init (void)
 {
-  list_init (&buffer_cache);
-  lock_init (&buffer_cache_lock);
-  list_init (&read_ahead);
+  size_t i, j;
+  struct buf_elem * pool;
+  policy = policy_find (buffer_cache_policy);
+  if (policy == NULL)
+    PANIC ("unknown buffer cache policy `%s'", buffer_cache_policy);
+  if (buffer_cache_size < BUFFER_CACHE_MIN)
+    buffer_cache_size = BUFFER_CACHE_MIN;
+  /* Carve every element out of contiguous kernel pages up front. */
+  buffer_cache_pages = DIV_ROUND_UP (buffer_cache_size
+                                     * sizeof (struct buf_elem), PGSIZE);
+  buffer_cache_pool = palloc_get_multiple (0, buffer_cache_pages);
+  if (buffer_cache_pool == NULL)
+    PANIC ("cannot allocate a buffer cache of %zu sectors",
+           buffer_cache_size);
+  write_behind_batch = malloc (buffer_cache_size
+                               * sizeof (struct buf_elem *));
+  if (write_behind_batch == NULL)
+    PANIC ("cannot allocate write behind batch");
+  /* As many shards as possible while each holds BUFFER_CACHE_MIN
+   * elements, so that eviction in a shard seldom finds all of them
+   * held. */
+  buffer_cache_shard_cnt = 1;
+  buffer_cache_shard_bits = 0;
+  while (buffer_cache_shard_cnt < BUFFER_CACHE_SHARDS
+         && buffer_cache_shard_cnt * 2 * BUFFER_CACHE_MIN <= buffer_cache_size)
+  {
+    buffer_cache_shard_cnt <<= 1;
+    ++buffer_cache_shard_bits;
+  }
+  printf ("Buffer cache: %zu sectors (%zu kB) in %zu pages, %zu shards, "
+          "%s policy.\n",
+          buffer_cache_size, buffer_cache_size * DISK_SECTOR_SIZE / 1024,
+          buffer_cache_pages, buffer_cache_shard_cnt, policy->name);
+
+  pool = buffer_cache_pool;
+  for (i = 0; i < buffer_cache_shard_cnt; ++i)
+  {
+    struct cache_shard * shard = &buffer_cache_shards[i];
+    lock_init (&shard->lock);
+    shard->pool = pool;
+    shard->size = buffer_cache_size / buffer_cache_shard_cnt
+                  + (i < buffer_cache_size % buffer_cache_shard_cnt);
+    pool += shard->size;
+    shard->cnt = 0;
+    list_init (&shard->elems);
+    memset (&shard->stats, 0, sizeof shard->stats);
+    /* About one element per bucket. */
+    for (shard->buckets = 1; shard->buckets < shard->size;
+         shard->buckets <<= 1)
+      continue;
+    shard->index = malloc (shard->buckets * sizeof (struct list));
+    if (shard->index == NULL)
+      PANIC ("cannot allocate buffer cache index");
+    for (j = 0; j < shard->buckets; ++j)
+      list_init (&shard->index[j]);
+    policy->init (shard);
+  }
+  read_ahead_head = 0;
+  read_ahead_cnt = 0;
   lock_init (&read_ahead_lock);
   cond_init (&read_ahead_cond);
   sema_init (&read_daemon_sema, 0);
   sema_init (&write_daemon_sema, 0);
+  lock_init (&write_behind_lock);
   cond_init (&write_daemon_cond);
   is_read_ahead_done = false;
   is_write_behind_done = false;
-  buffer_cache_curr = list_begin (&buffer_cache);
-  buffer_cache_cnt = 0;
+  is_write_behind_pending = false;
+  buffer_cache_dirty = 0;
+  write_behind_flushes = write_behind_flushed = 0;
   thread_create ("timer_daemon", PRI_DEFAULT, timer_daemon, NULL);
   thread_create ("read_ahead_daemon", PRI_DEFAULT, read_ahead_daemon, NULL);
   thread_create ("write_behind_daemon", PRI_DEFAULT, write_behind_daemon, NULL);
@@ -102,37 +280,43 @@ buffer_cache_init (void)
 static void
 timer_daemon (void * aux UNUSED)
 {
-  lock_acquire (&buffer_cache_lock);
+  lock_acquire (&write_behind_lock);
   while (!is_write_behind_done)
   {
-    lock_release (&buffer_cache_lock);
+    lock_release (&write_behind_lock);
     timer_msleep (5000);
-    lock_acquire (&buffer_cache_lock);
-    cond_signal (&write_daemon_cond, &buffer_cache_lock);
+    write_behind_request ();
+    lock_acquire (&write_behind_lock);
   }
-  lock_release (&buffer_cache_lock);
+  lock_release (&write_behind_lock);
+}
+
+/* Signals the write behind daemon to start a pass. */
+static void
+write_behind_request (void)
+{
+  lock_acquire (&write_behind_lock);
+  is_write_behind_pending = true;
+  cond_signal (&write_daemon_cond, &write_behind_lock);
+  lock_release (&write_behind_lock);
 }
 
 /* If there is blocks to read ahead, perform read ahead. If not sleep. */
 static void
 read_ahead_daemon (void * aux UNUSED)
 {
-  struct read_ahead_elem * target;
   disk_sector_t sector;
   lock_acquire (&read_ahead_lock);
   while (!is_read_ahead_done)
   {
     cond_wait (&read_ahead_cond, &read_ahead_lock);
-    while (!list_empty (&read_ahead))
+    while (read_ahead_cnt > 0 && !is_read_ahead_done)
     {
-      target = list_entry (list_pop_front (&read_ahead),
-                           struct read_ahead_elem, elem);
+      sector = read_ahead_queue[read_ahead_head];
+      read_ahead_head = (read_ahead_head + 1) % READ_AHEAD_QUEUE;
+      --read_ahead_cnt;
       lock_release (&read_ahead_lock);
-      sector = target->sector;
-      free (target);
-      /* Read ahead daemon does not perform any modification on cache,
-       * so it does not need to acquire lock on cache. */
-      buffer_cache_find (sector, false);
+      buffer_cache_prefetch (sector);
       lock_acquire (&read_ahead_lock);
     }
   }
@@ -142,127 +326,231 @@ read_ahead_daemon (void * aux UNUSED)
 }
 
 /* Most of the time this thread just sleeps. When it is awaken by some
- * other thread(usually timer daemon) it writes dirty blocks to disk. */
+ * other thread(usually timer daemon, or a writer when too many blocks
+ * are dirty) it writes dirty blocks to disk. */
 static void
 write_behind_daemon (void * aux UNUSED)
 {
-  struct buf_elem * curr;
-  struct list_elem * e;
-  lock_acquire (&buffer_cache_lock);
+  lock_acquire (&write_behind_lock);
   while (!is_write_behind_done)
   {
-    /* buffer_cache_lock acquired before traversing the list. */
-    e = list_begin (&buffer_cache);
-    while (e != list_end (&buffer_cache))
+    is_write_behind_pending = false;
+    lock_release (&write_behind_lock);
+    /* Changes to the free map are pushed into the cache first. */
+    free_map_flush ();
+    buffer_cache_flush ();
+    lock_acquire (&write_behind_lock);
+    while (!is_write_behind_pending && !is_write_behind_done)
+      cond_wait (&write_daemon_cond, &write_behind_lock);
+  }
+  /* Signal buffer_cache_done that it has completed its process. */
+  lock_release (&write_behind_lock);
+  sema_up (&write_daemon_sema);
+}
+
+/* Compares the sector numbers of two buffer cache elements. */
+static int
+buf_elem_compare (const void * a_, const void * b_)
+{
+  const struct buf_elem * a = *(struct buf_elem * const *) a_;
+  const struct buf_elem * b = *(struct buf_elem * const *) b_;
+  return a->sector < b->sector ? -1 : a->sector > b->sector;
+}
+
+/* Writes every dirty buffer cache element to disk in ascending order of
+ * sector number, so that runs of adjacent sectors are written one after
+ * another. The elements are collected in a single walk of each shard,
+ * taking one shard lock at a time, and held until written, so they
+ * cannot be evicted meanwhile. Only the write behind daemon, or
+ * buffer_cache_done after it has terminated, may call this function. */
+static void
+buffer_cache_flush (void)
+{
+  struct list_elem * e;
+  struct buf_elem * curr;
+  size_t cnt = 0, written = 0;
+  size_t i;
+  for (i = 0; i < buffer_cache_shard_cnt; ++i)
+  {
+    struct cache_shard * shard = &buffer_cache_shards[i];
+    lock_acquire (&shard->lock);
+    for (e = list_begin (&shard->elems); e != list_end (&shard->elems);
+         e = list_next (e))
     {
       curr = list_entry (e, struct buf_elem, elem);
       lock_acquire (&curr->mutex);
-      lock_release (&buffer_cache_lock);
-      if (curr->is_ready && curr->is_dirty)
+      if (curr->is_ready && curr->is_dirty && !curr->is_removed)
       {
-        curr->is_dirty = false;
-        lock_acquire (&curr->write_lock);
-        lock_release (&curr->mutex);
-        disk_write (filesys_disk, curr->sector, &curr->data[0]);
-        lock_release (&curr->write_lock);
+        ++curr->holders;
+        write_behind_batch[cnt++] = curr;
       }
-      else
-        lock_release (&curr->mutex);
-      lock_acquire (&buffer_cache_lock);
-      e = list_next (e);
+      lock_release (&curr->mutex);
     }
-    cond_wait (&write_daemon_cond, &buffer_cache_lock);
+    lock_release (&shard->lock);
   }
-  /* Signal buffer_cache_done that it has completed its process. */
-  lock_release (&buffer_cache_lock);
-  sema_up (&write_daemon_sema);
+
+  /* Sector numbers do not change while the elements are held. */
+  qsort (write_behind_batch, cnt, sizeof *write_behind_batch,
+         buf_elem_compare);
+  for (i = 0; i < cnt; ++i)
+  {
+    curr = write_behind_batch[i];
+    lock_acquire (&curr->mutex);
+    if (curr->is_dirty)
+    {
+      buffer_cache_set_dirty (curr, false);
+      lock_release (&curr->mutex);
+      rwlock_acquire_read (&curr->latch);
+      disk_write (filesys_disk, curr->sector, &curr->data[0]);
+      rwlock_release_read (&curr->latch);
+      ++written;
+    }
+    else
+      lock_release (&curr->mutex);
+    buffer_cache_epilogue (curr);
+  }
+  lock_acquire (&write_behind_lock);
+  ++write_behind_flushes;
+  write_behind_flushed += written;
+  lock_release (&write_behind_lock);
+}
+
+/* Sets TARGET's dirty flag to DIRTY and keeps count of dirty elements.
+ * Requests write behind when too many elements are dirty. TARGET's
+ * mutex must be held. */
+static void
+buffer_cache_set_dirty (struct buf_elem * target, bool dirty)
+{
+  ASSERT (lock_held_by_current_thread (&target->mutex));
+  if (target->is_dirty == dirty)
+    return;
+  target->is_dirty = dirty;
+  lock_acquire (&write_behind_lock);
+  if (!dirty)
+    --buffer_cache_dirty;
+  else if (++buffer_cache_dirty > buffer_cache_size / WRITE_BEHIND_RATIO
+           && !is_write_behind_pending)
+  {
+    is_write_behind_pending = true;
+    cond_signal (&write_daemon_cond, &write_behind_lock);
+  }
+  lock_release (&write_behind_lock);
 }
 
-/* Create an initialize a buffer cache element associated with sector
- * number SECTOR. If HOLD is set to true, the new buffer cache element's
- * holder will be set to 1. */
+/* Initialize the next unused element of SHARD's preallocated pool and
+ * associate it with sector number SECTOR. If HOLD is set to true, the
+ * new buffer cache element's holder will be set to 1. */
 static struct buf_elem *
-buf_elem_init (disk_sector_t sector, bool hold)
+buf_elem_init (struct cache_shard * shard, disk_sector_t sector, bool hold,
+               bool ahead)
 {
-  struct buf_elem * new = malloc (sizeof (struct buf_elem));
-  if (new == NULL) return NULL;
+  ASSERT (shard->cnt < shard->size);
+  struct buf_elem * new = &shard->pool[shard->cnt];
   new->sector = sector;
   new->is_dirty = false;
   new->is_ready = false;
   new->is_removed = false;
+  new->is_read_ahead = ahead;
   lock_init (&new->mutex);
-  lock_init (&new->write_lock);
+  rwlock_init (&new->latch);
   cond_init (&new->data_ready);
   new->holders = hold ? 1 : 0;
-  ++buffer_cache_cnt;
-  list_push_back (&buffer_cache, &new->elem);
+  ++shard->cnt;
+  list_push_back (&shard->elems, &new->elem);
+  list_push_back (buffer_cache_bucket (shard, sector), &new->index_elem);
+  policy->insert (shard, new);
   return new;
 }
 
 void
 buffer_cache_done (void)
 {
-  struct list_elem * e;
   /* Signal read ahead daemon to terminate. */
   lock_acquire (&read_ahead_lock);
   is_read_ahead_done = true;
   cond_signal (&read_ahead_cond, &read_ahead_lock);
   lock_release (&read_ahead_lock);
-  /* Wait for read ahead daemon to terminate. */
+  /* Wait for read ahead daemon to terminate. Requests it did not serve
+   * are simply dropped. */
   sema_down (&read_daemon_sema);
-  lock_acquire (&read_ahead_lock);
-  /* Just in case there are some elements read ahead daemon did not
-   * free. */
-  while (!list_empty (&read_ahead))
-  {
-    e = list_pop_front (&read_ahead);
-    struct read_ahead_elem * curr;
-    curr = list_entry (e, struct read_ahead_elem, elem);
-    free (curr);
-  }
-  lock_release (&read_ahead_lock);
   /* Signal write behind daemon to terminate. */
-  lock_acquire (&buffer_cache_lock);
+  lock_acquire (&write_behind_lock);
   is_write_behind_done = true;
-  cond_signal (&write_daemon_cond, &buffer_cache_lock);
-  lock_release (&buffer_cache_lock);
+  cond_signal (&write_daemon_cond, &write_behind_lock);
+  lock_release (&write_behind_lock);
   /* Wait for write behind daemon to terminate. */
   sema_down (&write_daemon_sema);
   /* Write all the dirty cache elements to disk. */
-  lock_acquire (&buffer_cache_lock);
-  while (!list_empty (&buffer_cache))
-  {
-    e = list_pop_front (&buffer_cache);
-    struct buf_elem * curr = list_entry (e, struct buf_elem, elem);
-    if (curr->is_dirty)
-      disk_write (filesys_disk, curr->sector, &curr->data[0]);
-  }
-  lock_release (&buffer_cache_lock);
+  buffer_cache_flush ();
+}
+
+/* Marks TARGET, an element of SHARD in the sector index, removed.
+ * SHARD's lock must be held. */
+static void
+buffer_cache_drop (struct cache_shard * shard, struct buf_elem * target)
+{
+  lock_acquire (&target->mutex);
+  /* Just marks. */
+  target->is_removed = true;
+  buffer_cache_set_dirty (target, false);
+  list_remove (&target->index_elem);
+  policy->demote (shard, target);
+  lock_release (&target->mutex);
 }
 
 /* Mark the cache element corresponding to sector number SECTOR. It is
- * actually removed from list when it is evicted. */
+ * dropped from the sector index at once and actually removed from list
+ * when it is evicted. Its contents are never written back. */
 void
 buffer_cache_remove (disk_sector_t sector)
 {
+  struct cache_shard * shard = buffer_cache_shard (sector);
   struct buf_elem * target;
-  struct list_elem * e;
-  lock_acquire (&buffer_cache_lock);
-  for (e = list_begin (&buffer_cache); e != list_end (&buffer_cache);
-       e = list_next (e))
+  lock_acquire (&shard->lock);
+  target = buffer_cache_lookup (shard, sector);
+  if (target != NULL)
+    buffer_cache_drop (shard, target);
+  lock_release (&shard->lock);
+}
+
+/* Same as buffer_cache_remove for the CNT sectors starting at START.
+ * Each shard is locked once. When the run is longer than a shard, the
+ * shard's elements are checked in a single pass instead of looking up
+ * every sector of the run. */
+void
+buffer_cache_remove_range (disk_sector_t start, size_t cnt)
+{
+  size_t i;
+  for (i = 0; i < buffer_cache_shard_cnt; ++i)
   {
-    target = list_entry (e, struct buf_elem, elem);
-    lock_acquire (&target->mutex);
-    if (target->sector == sector)
+    struct cache_shard * shard = &buffer_cache_shards[i];
+    lock_acquire (&shard->lock);
+    if (cnt > shard->cnt)
     {
-      /* Just marks. */
-      target->is_removed = true;
-      lock_release (&target->mutex);
-      break;
+      struct list_elem * e;
+      for (e = list_begin (&shard->elems); e != list_end (&shard->elems);
+           e = list_next (e))
+      {
+        struct buf_elem * target = list_entry (e, struct buf_elem, elem);
+        /* Removed elements are not in the index anymore. */
+        if (!target->is_removed && target->sector - start < cnt)
+          buffer_cache_drop (shard, target);
+      }
+    }
+    else
+    {
+      /* First sector of the run in this shard. */
+      disk_sector_t sector = start + ((i - start)
+                                      & (buffer_cache_shard_cnt - 1));
+      for (; sector - start < cnt; sector += buffer_cache_shard_cnt)
+      {
+        struct buf_elem * target = buffer_cache_lookup (shard, sector);
+        if (target != NULL)
+          buffer_cache_drop (shard, target);
+      }
     }
-    lock_release (&target->mutex);
+    lock_release (&shard->lock);
   }
-  lock_release (&buffer_cache_lock);
 }
 
 /* Decrement the holder value of TARGET. */
@@ -277,74 +565,187 @@ buffer_cache_epilogue (struct buf_elem * target)
 
 
 /* Reads the buffer cache corresponding to sector number SECTOR and
- * copies LENGTH bytes starting from OFFSET to BUFFER. If NEXT is not
- * END_OF_FILE, it will signal to read ahead daemon to read ahead that
- * sector. Returns false if read fails. */
+ * copies LENGTH bytes starting from OFFSET to BUFFER. Returns false if
+ * read fails. */
 bool
-buffer_cache_read (disk_sector_t sector, disk_sector_t next, off_t offset,
-                   size_t length, void * buffer)
+buffer_cache_read (disk_sector_t sector, off_t offset, size_t length,
+                   void * buffer)
 {
   ASSERT (offset + length <= DISK_SECTOR_SIZE);
-  struct buf_elem * cache = buffer_cache_find (sector, true);
+  struct buf_elem * cache = buffer_cache_find (sector, true, true);
   if (cache == NULL) return false;
   lock_release (&cache->mutex);     /* Acquired by buffer_cache_find. */
+  rwlock_acquire_read (&cache->latch);
   memcpy (buffer, &cache->data[offset], length);
+  rwlock_release_read (&cache->latch);
   buffer_cache_epilogue (cache);
+  return true;
+}
+
+/* Pins the buffer cache element of sector number SECTOR and returns a
+ * pointer to its DISK_SECTOR_SIZE bytes of data, reading it from disk
+ * if needed. The element is not evicted until buffer_cache_unpin is
+ * called with the returned pointer, and its latch is held shared until
+ * then, so the caller must neither write to nor pin SECTOR again
+ * meanwhile. Returns a null pointer if read fails. */
+const void *
+buffer_cache_pin (disk_sector_t sector)
+{
+  struct buf_elem * cache = buffer_cache_find (sector, true, true);
+  if (cache == NULL) return NULL;
+  lock_release (&cache->mutex);     /* Acquired by buffer_cache_find. */
+  rwlock_acquire_read (&cache->latch);
+  return cache->data;
+}
+
+/* Releases the element pinned by buffer_cache_pin, whose data is
+ * DATA. */
+void
+buffer_cache_unpin (const void * data)
+{
+  ASSERT (data != NULL);
+  struct buf_elem * cache;
+  cache = (struct buf_elem *) ((const uint8_t *) data
+                               - offsetof (struct buf_elem, data));
+  rwlock_release_read (&cache->latch);
+  buffer_cache_epilogue (cache);
+}
+
+/* Asks the read ahead daemon to bring sector number SECTOR into the
+ * cache. Returns false if the request was dropped because too many are
+ * pending, in which case the caller may ask again later. */
+bool
+buffer_cache_read_ahead (disk_sector_t sector)
+{
+  bool queued = false;
   lock_acquire (&read_ahead_lock);
-  if ((next != END_OF_FILE) && !is_read_ahead_done)
+  if (!is_read_ahead_done && read_ahead_cnt < READ_AHEAD_QUEUE)
   {
-    struct read_ahead_elem * new = malloc (sizeof (struct read_ahead_elem));
-    if (new != NULL)
-    {
-      new->sector = next;
-      list_push_back (&read_ahead, &new->elem);
-      /* Signal read_ahead_daemon that there is a block to read. */
-      cond_signal (&read_ahead_cond, &read_ahead_lock);
-    }
+    size_t tail = (read_ahead_head + read_ahead_cnt) % READ_AHEAD_QUEUE;
+    read_ahead_queue[tail] = sector;
+    ++read_ahead_cnt;
+    /* Signal read_ahead_daemon that there is a block to read. */
+    cond_signal (&read_ahead_cond, &read_ahead_lock);
+    queued = true;
   }
   lock_release (&read_ahead_lock);
-  return true;
+  return queued;
+}
+
+/* Stores the buffer cache statistics in STATS. */
+void
+buffer_cache_get_stats (struct cache_stats * stats)
+{
+  size_t i;
+  memset (stats, 0, sizeof *stats);
+  for (i = 0; i < buffer_cache_shard_cnt; ++i)
+  {
+    struct cache_shard * shard = &buffer_cache_shards[i];
+    lock_acquire (&shard->lock);
+    stats->hits += shard->stats.hits;
+    stats->misses += shard->stats.misses;
+    stats->write_allocs += shard->stats.write_allocs;
+    stats->evictions += shard->stats.evictions;
+    stats->dirty_evictions += shard->stats.dirty_evictions;
+    stats->read_ahead += shard->stats.read_ahead;
+    stats->read_ahead_hits += shard->stats.read_ahead_hits;
+    stats->read_ahead_wasted += shard->stats.read_ahead_wasted;
+    stats->ready_waits += shard->stats.ready_waits;
+    lock_release (&shard->lock);
+  }
+  lock_acquire (&write_behind_lock);
+  stats->flushes = write_behind_flushes;
+  stats->flushed = write_behind_flushed;
+  lock_release (&write_behind_lock);
+}
+
+/* Prints buffer cache statistics. */
+void
+buffer_cache_print_stats (void)
+{
+  struct cache_stats stats;
+  buffer_cache_get_stats (&stats);
+  printf ("Buffer cache: %llu hits, %llu misses (%llu not read), "
+          "%llu waits for reads\n",
+          stats.hits, stats.misses, stats.write_allocs, stats.ready_waits);
+  printf ("Buffer cache: %llu evictions (%llu dirty), "
+          "%llu sectors written in %llu write behind passes\n",
+          stats.evictions, stats.dirty_evictions, stats.flushed,
+          stats.flushes);
+  printf ("Buffer cache: %llu read ahead, %llu used, %llu wasted\n",
+          stats.read_ahead, stats.read_ahead_hits, stats.read_ahead_wasted);
 }
 
 /* Writes LENGTH bytes of BUFFER to the cache corresponding to sector
  * number SECTOR starting from OFFSET bytes. If ZERO is set to true,
  * all the reamining data will be set to zero. Returns false when an
- * error occurs. */
+ * error occurs. A write that overwrites the whole sector does not read
+ * it from disk on a miss. */
 bool
 buffer_cache_write (disk_sector_t sector, off_t offset, size_t length,
                     const void * buffer, bool zero)
 {
   ASSERT (offset + length <= DISK_SECTOR_SIZE);
-  struct buf_elem * cache = buffer_cache_find (sector, true);
+  bool whole = offset == 0 && (zero || length == DISK_SECTOR_SIZE);
+  struct buf_elem * cache = buffer_cache_find (sector, true, !whole);
   if (cache == NULL) return false;
-  cache->is_dirty = true;           /* Write makes cache dirty. */
-  lock_acquire (&cache->write_lock);
   lock_release (&cache->mutex);     /* Acquried by buffer_cache_find. */
+  rwlock_acquire_write (&cache->latch);
   memcpy (&cache->data[offset], buffer, length);
   off_t zero_off = offset + length;
   if (zero)
     memset (&cache->data[zero_off], 0, DISK_SECTOR_SIZE - zero_off);
-  lock_release (&cache->write_lock);
-  buffer_cache_epilogue (cache);
+  rwlock_release_write (&cache->latch);
+  /* Write makes cache dirty. Marked only after the copy, so that a
+   * write back that started earlier cannot clear it. */
+  lock_acquire (&cache->mutex);
+  if (!cache->is_ready)
+  {
+    /* Installed without a read. The data is complete now. */
+    cache->is_ready = true;
+    cond_broadcast (&cache->data_ready, &cache->mutex);
+  }
+  buffer_cache_set_dirty (cache, true);
+  --cache->holders;
+  ASSERT (cache->holders >= 0);
+  lock_release (&cache->mutex);
   return true;
 }
 
-/* Adds a struct buf_elem corresponding to SECTOR to buffer_cache. Must
- * be called after acquiring buffer_cache_lock. The lock is released by
- * this function. Returns the element added to buffer cache list. */
+/* Adds a struct buf_elem corresponding to SECTOR to SHARD, which must
+ * be SECTOR's shard. Must be called after acquiring SHARD's lock. The
+ * lock is released by this function. Returns the element added.
+ *
+ * If FILL is false, the sector is not read from disk and the element
+ * is returned held, with its mutex acquired, but not ready. The caller
+ * must then overwrite all of its data and mark it ready. Others that
+ * find the sector meanwhile wait as they would for the disk read. */
 static struct buf_elem *
-buffer_cache_add (disk_sector_t sector, bool hold)
+buffer_cache_add (struct cache_shard * shard, disk_sector_t sector,
+                  bool hold, bool ahead, bool fill)
 {
   struct buf_elem * new;
-  if (buffer_cache_cnt < BUFFER_CACHE_LIMIT)
+  ASSERT (fill || hold);
+  if (ahead)
+    ++shard->stats.read_ahead;
+  else
+    ++shard->stats.misses;
+  if (!fill)
+    ++shard->stats.write_allocs;
+  if (shard->cnt < shard->size)
   {
-    new = buf_elem_init (sector, hold);
-    lock_release (&buffer_cache_lock);
+    new = buf_elem_init (shard, sector, hold, ahead);
+    lock_release (&shard->lock);
   }
   else
   {
-    /* buffer_cache_lock released by buffer_cache_evict. */
-    new = buffer_cache_evict (sector, hold);
+    /* Shard lock released by buffer_cache_evict. */
+    new = buffer_cache_evict (shard, sector, hold, ahead);
+  }
+  if (!fill)
+  {
+    lock_acquire (&new->mutex);
+    return new;
   }
   disk_read (filesys_disk, sector, &new->data[0]);
   lock_acquire (&new->mutex);
@@ -356,86 +757,400 @@ buffer_cache_add (disk_sector_t sector, bool hold)
   return new;
 }
 
-/* Evicts a buffer cache element from buffer cache list and change that
- * element to have sector number SECTOR. If HOLD is set to true, set
- * holder to 1 and acquire mutex. Returns the element. */
+/* Evicts an element of SHARD chosen by the replacement policy and
+ * change that element to have sector number SECTOR, which belongs to
+ * SHARD. If HOLD is set to true, set holder to 1 and acquire mutex.
+ * Returns the element. */
 static struct buf_elem *
-buffer_cache_evict (disk_sector_t sector, bool hold)
+buffer_cache_evict (struct cache_shard * shard, disk_sector_t sector,
+                    bool hold, bool ahead)
 {
   struct buf_elem * victim;
   disk_sector_t old_sector;
   bool is_dirty;
-  while (true)
+  /* Every element is held. Holders release them without taking the
+   * shard lock, so just wait. */
+  while ((victim = policy->victim (shard)) == NULL)
+    thread_yield ();
+  old_sector = victim->sector;
+  victim->holders = hold ? 1 : 0;
+  victim->sector = sector;
+  victim->is_ready = false;
+  /* The sector of a removed element may belong to another file by now,
+   * so its data is dropped even if a late write made it dirty again. */
+  is_dirty = victim->is_dirty && !victim->is_removed;
+  buffer_cache_set_dirty (victim, false);
+  ++shard->stats.evictions;
+  if (is_dirty)
+    ++shard->stats.dirty_evictions;
+  if (victim->is_read_ahead)
+    ++shard->stats.read_ahead_wasted;
+  victim->is_read_ahead = ahead;
+  /* Rehash under the new sector number. */
+  if (!victim->is_removed)
+    list_remove (&victim->index_elem);
+  list_push_back (buffer_cache_bucket (shard, sector), &victim->index_elem);
+  victim->is_removed = false;
+  policy->insert (shard, victim);
+  lock_release (&shard->lock);
+  /* Nobody holds the victim, and finders of its new sector wait until
+   * it is ready, so its data can be used without the latch. */
+  lock_release (&victim->mutex);
+  if (is_dirty)
+    disk_write (filesys_disk, old_sector, &victim->data[0]);
+  return victim;
+}
+
+/* Returns true if TARGET can be evicted, in which case its mutex is
+ * left acquired. */
+static bool
+buf_elem_evictable (struct buf_elem * target)
+{
+  lock_acquire (&target->mutex);
+  if (target->holders == 0 && target->is_ready)
+    return true;
+  lock_release (&target->mutex);
+  return false;
+}
+
+/* Returns the first element of QUEUE, a list of policy_elem in order of
+ * eviction, that can be evicted. The element is removed from QUEUE and
+ * its mutex is acquired. Returns NULL if there is none. */
+static struct buf_elem *
+policy_queue_victim (struct list * queue)
+{
+  struct list_elem * e;
+  for (e = list_begin (queue); e != list_end (queue); e = list_next (e))
   {
-    /* Circular list implementation. */
-    if (buffer_cache_curr == list_end (&buffer_cache))
-      buffer_cache_curr = list_begin (&buffer_cache);
-    victim = list_entry (buffer_cache_curr, struct buf_elem, elem);
-    buffer_cache_curr = list_next (buffer_cache_curr);
-    lock_acquire (&victim->mutex);
-    if (victim->holders == 0 && victim->is_ready)
+    struct buf_elem * target = list_entry (e, struct buf_elem, policy_elem);
+    if (buf_elem_evictable (target))
     {
-      old_sector = victim->sector;
-      victim->holders = hold ? 1 : 0;
-      victim->sector = sector;
-      victim->is_ready = false;
-      is_dirty = victim->is_dirty;
-      victim->is_dirty = false;
-      if (victim->is_removed)
-      {
-        victim->is_removed = false;
-        lock_release (&buffer_cache_lock);
-        lock_release (&victim->mutex);
-        return victim;
-      }
-      break;
+      list_remove (e);
+      return target;
     }
-    lock_release (&victim->mutex);
   }
-  lock_release (&buffer_cache_lock);
-  if (is_dirty)
+  return NULL;
+}
+
+/* Clock policy. Elements form a ring swept by a hand. An element that
+ * was accessed since the hand last passed gets a second chance. */
+
+static void
+clock_init (struct cache_shard * shard)
+{
+  list_init (&shard->queue);
+  shard->clock_hand = list_end (&shard->queue);
+}
+
+/* New elements are placed just behind the hand, so they are examined
+ * last. */
+static void
+clock_insert (struct cache_shard * shard, struct buf_elem * target)
+{
+  target->is_referenced = false;
+  list_insert (shard->clock_hand, &target->policy_elem);
+}
+
+static void
+clock_access (struct cache_shard * shard UNUSED, struct buf_elem * target)
+{
+  target->is_referenced = true;
+}
+
+static void
+clock_demote (struct cache_shard * shard UNUSED, struct buf_elem * target)
+{
+  target->is_referenced = false;
+}
+
+static struct buf_elem *
+clock_victim (struct cache_shard * shard)
+{
+  /* Two rounds clear every reference bit on the way. */
+  size_t left = 2 * list_size (&shard->queue);
+  for (; left > 0; --left)
   {
-    /* Write if dirty. */
-    lock_acquire (&victim->write_lock);
-    lock_release (&victim->mutex);
-    disk_write (filesys_disk, old_sector, &victim->data[0]);
-    lock_release (&victim->write_lock);
+    if (shard->clock_hand == list_end (&shard->queue))
+      shard->clock_hand = list_begin (&shard->queue);
+    struct buf_elem * target = list_entry (shard->clock_hand,
+                                           struct buf_elem, policy_elem);
+    shard->clock_hand = list_next (shard->clock_hand);
+    if (target->is_referenced)
+      target->is_referenced = false;
+    else if (buf_elem_evictable (target))
+    {
+      list_remove (&target->policy_elem);
+      return target;
+    }
+  }
+  return NULL;
+}
+
+static const struct cache_policy clock_policy =
+  {"clock", clock_init, clock_insert, clock_access, clock_demote,
+   clock_victim};
+
+/* LRU policy. Elements are kept in order of their last access, from the
+ * least to the most recently used. */
+
+static void
+lru_init (struct cache_shard * shard)
+{
+  list_init (&shard->queue);
+}
+
+static void
+lru_insert (struct cache_shard * shard, struct buf_elem * target)
+{
+  list_push_back (&shard->queue, &target->policy_elem);
+}
+
+static void
+lru_access (struct cache_shard * shard, struct buf_elem * target)
+{
+  list_remove (&target->policy_elem);
+  list_push_back (&shard->queue, &target->policy_elem);
+}
+
+static void
+lru_demote (struct cache_shard * shard, struct buf_elem * target)
+{
+  list_remove (&target->policy_elem);
+  list_push_front (&shard->queue, &target->policy_elem);
+}
+
+static struct buf_elem *
+lru_victim (struct cache_shard * shard)
+{
+  return policy_queue_victim (&shard->queue);
+}
+
+static const struct cache_policy lru_policy =
+  {"lru", lru_init, lru_insert, lru_access, lru_demote, lru_victim};
+
+/* 2Q policy (Johnson and Shasha). A sector seen for the first time
+ * enters a FIFO queue. It is promoted to a main LRU queue only if it is
+ * requested again soon after leaving the FIFO queue, which is tracked
+ * by a queue of the sector numbers recently evicted from it. A large
+ * sequential scan thus only cycles through the FIFO queue and does not
+ * flush the sectors that are used over and over. */
+
+static void
+two_q_init (struct cache_shard * shard)
+{
+  list_init (&shard->two_q_in);
+  list_init (&shard->queue);
+  shard->two_q_in_cnt = 0;
+  /* Remember as many evicted sectors as half the shard holds. */
+  shard->two_q_out_size = shard->size / 2;
+  shard->two_q_out = malloc (shard->two_q_out_size
+                             * sizeof *shard->two_q_out);
+  if (shard->two_q_out == NULL)
+    PANIC ("cannot allocate 2Q queue");
+  shard->two_q_out_head = shard->two_q_out_cnt = 0;
+}
+
+/* Removes SECTOR from SHARD's TWO_Q_OUT and returns true if it was
+ * there. */
+static bool
+two_q_out_remove (struct cache_shard * shard, disk_sector_t sector)
+{
+  size_t i;
+  for (i = 0; i < shard->two_q_out_cnt; ++i)
+  {
+    size_t idx = (shard->two_q_out_head + i) % shard->two_q_out_size;
+    if (shard->two_q_out[idx] == sector)
+    {
+      /* Fill the hole with the oldest sector. */
+      shard->two_q_out[idx] = shard->two_q_out[shard->two_q_out_head];
+      shard->two_q_out_head = (shard->two_q_out_head + 1)
+                              % shard->two_q_out_size;
+      --shard->two_q_out_cnt;
+      return true;
+    }
+  }
+  return false;
+}
+
+/* Adds SECTOR to SHARD's TWO_Q_OUT, forgetting the oldest sector if
+ * full. */
+static void
+two_q_out_add (struct cache_shard * shard, disk_sector_t sector)
+{
+  if (shard->two_q_out_cnt == shard->two_q_out_size)
+  {
+    shard->two_q_out_head = (shard->two_q_out_head + 1)
+                            % shard->two_q_out_size;
+    --shard->two_q_out_cnt;
+  }
+  shard->two_q_out[(shard->two_q_out_head + shard->two_q_out_cnt)
+                   % shard->two_q_out_size] = sector;
+  ++shard->two_q_out_cnt;
+}
+
+static void
+two_q_insert (struct cache_shard * shard, struct buf_elem * target)
+{
+  if (two_q_out_remove (shard, target->sector))
+  {
+    target->queue = TWO_Q_MAIN;
+    list_push_back (&shard->queue, &target->policy_elem);
   }
   else
-    lock_release (&victim->mutex);
-  return victim;
+  {
+    target->queue = TWO_Q_IN;
+    list_push_back (&shard->two_q_in, &target->policy_elem);
+    ++shard->two_q_in_cnt;
+  }
+}
+
+/* Hits in TWO_Q_IN are ignored, since they are mostly part of the same
+ * burst of accesses that brought the sector in. */
+static void
+two_q_access (struct cache_shard * shard, struct buf_elem * target)
+{
+  if (target->queue == TWO_Q_MAIN)
+  {
+    list_remove (&target->policy_elem);
+    list_push_back (&shard->queue, &target->policy_elem);
+  }
+}
+
+static void
+two_q_demote (struct cache_shard * shard, struct buf_elem * target)
+{
+  list_remove (&target->policy_elem);
+  if (target->queue == TWO_Q_MAIN)
+    list_push_front (&shard->queue, &target->policy_elem);
+  else
+    list_push_front (&shard->two_q_in, &target->policy_elem);
+}
+
+static struct buf_elem *
+two_q_victim (struct cache_shard * shard)
+{
+  struct buf_elem * target = NULL;
+  /* TWO_Q_IN is allowed a quarter of the shard. */
+  if (shard->two_q_in_cnt > shard->size / 4 || list_empty (&shard->queue))
+    target = policy_queue_victim (&shard->two_q_in);
+  if (target == NULL)
+    target = policy_queue_victim (&shard->queue);
+  if (target == NULL)
+    target = policy_queue_victim (&shard->two_q_in);
+  if (target != NULL && target->queue == TWO_Q_IN)
+  {
+    --shard->two_q_in_cnt;
+    if (!target->is_removed)
+      two_q_out_add (shard, target->sector);
+  }
+  return target;
+}
+
+static const struct cache_policy two_q_policy =
+  {"2q", two_q_init, two_q_insert, two_q_access, two_q_demote,
+   two_q_victim};
+
+/* Available replacement policies, terminated by a null pointer. */
+static const struct cache_policy * const cache_policies[] =
+  {&clock_policy, &lru_policy, &two_q_policy, NULL};
+
+/* Returns the replacement policy named NAME, or NULL if there is no
+ * such policy. */
+static const struct cache_policy *
+policy_find (const char * name)
+{
+  size_t i;
+  for (i = 0; cache_policies[i] != NULL; ++i)
+    if (!strcmp (cache_policies[i]->name, name))
+      return cache_policies[i];
+  return NULL;
+}
+
+/* Returns the shard SECTOR belongs to. Consecutive sectors go to
+ * different shards, so a sequential scan spreads over all of them. */
+static struct cache_shard *
+buffer_cache_shard (disk_sector_t sector)
+{
+  return &buffer_cache_shards[sector & (buffer_cache_shard_cnt - 1)];
+}
+
+/* Returns the bucket of SHARD's sector index where SECTOR belongs. The
+ * bits that chose the shard are the same for all of its sectors, so
+ * they are dropped. */
+static struct list *
+buffer_cache_bucket (struct cache_shard * shard, disk_sector_t sector)
+{
+  return &shard->index[(sector >> buffer_cache_shard_bits)
+                       & (shard->buckets - 1)];
+}
+
+/* Returns the buf_elem in SHARD's sector index whose sector number is
+ * SECTOR, or NULL if there is none. SHARD's lock must be held. */
+static struct buf_elem *
+buffer_cache_lookup (struct cache_shard * shard, disk_sector_t sector)
+{
+  struct list * bucket = buffer_cache_bucket (shard, sector);
+  struct list_elem * e;
+  ASSERT (lock_held_by_current_thread (&shard->lock));
+  for (e = list_begin (bucket); e != list_end (bucket); e = list_next (e))
+  {
+    struct buf_elem * target = list_entry (e, struct buf_elem, index_elem);
+    if (target->sector == sector)
+      return target;
+  }
+  return NULL;
 }
 
 /* Retruns the buf_elem corresponding to SECTOR. If HOLD is true,
  * increments the buf_elem's holders value and acquires the correponding
- * mutex. Acquires BUFER_CACHE_LOCK and corresponding MUTEX. */
+ * mutex. Acquires the lock of SECTOR's shard and corresponding MUTEX.
+ * If FILL is false and SECTOR is not cached, it is installed without
+ * being read, as buffer_cache_add describes. */
 static struct buf_elem *
-buffer_cache_find (disk_sector_t sector, bool hold)
+buffer_cache_find (disk_sector_t sector, bool hold, bool fill)
 {
+  struct cache_shard * shard = buffer_cache_shard (sector);
   struct buf_elem * target;
-  struct list_elem *e;
-  lock_acquire (&buffer_cache_lock);
-  for (e = list_begin (&buffer_cache); e != list_end (&buffer_cache);
-       e = list_next (e))
+  lock_acquire (&shard->lock);
+  target = buffer_cache_lookup (shard, sector);
+  if (target != NULL)
   {
-    target = list_entry (e, struct buf_elem, elem);
+    policy->access (shard, target);
     lock_acquire (&target->mutex);
-    lock_release (&buffer_cache_lock);
-    if (target->sector == sector)
+    ++shard->stats.hits;
+    if (!target->is_ready)
+      ++shard->stats.ready_waits;
+    if (target->is_read_ahead)
     {
-      if (hold)
-        ++target->holders;
-      while (!target->is_ready)
-        cond_wait (&target->data_ready, &target->mutex);
-      if (!hold)
-        lock_release (&target->mutex);
-      return target;
+      target->is_read_ahead = false;
+      ++shard->stats.read_ahead_hits;
     }
-    lock_release (&target->mutex);
-    lock_acquire (&buffer_cache_lock);
+    lock_release (&shard->lock);
+    if (hold)
+      ++target->holders;
+    while (!target->is_ready)
+      cond_wait (&target->data_ready, &target->mutex);
+    if (!hold)
+      lock_release (&target->mutex);
+    return target;
   }
-  /* BUFFER_CACHE_ADD requires BUFFER_CACHE_LOCK to be acquired. It
+  /* BUFFER_CACHE_ADD requires the shard lock to be acquired. It
    * releases the lock. */
-  return buffer_cache_add (sector, hold);
+  return buffer_cache_add (shard, sector, hold, false, fill);
 }
 
+/* Brings sector number SECTOR into the cache on behalf of the read
+ * ahead daemon unless it is already there. */
+static void
+buffer_cache_prefetch (disk_sector_t sector)
+{
+  struct cache_shard * shard = buffer_cache_shard (sector);
+  lock_acquire (&shard->lock);
+  if (buffer_cache_lookup (shard, sector) != NULL)
+  {
+    lock_release (&shard->lock);
+    return;
+  }
+  /* Releases the shard lock. */
+  buffer_cache_add (shard, sector, false, true, true);
+}
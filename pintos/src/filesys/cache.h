@@ -3,17 +3,30 @@
 
 #include <stdbool.h>
 #include <stddef.h>
+#include <cache-stats.h>
 #include "devices/disk.h"
 #include "filesys/off_t.h"
 
-#define END_OF_FILE (disk_sector_t)(0)
+/* Default number of sectors in the buffer cache. */
+#define BUFFER_CACHE_DEFAULT 64
+
+/* Number of sectors in the buffer cache. */
+extern size_t buffer_cache_size;
+/* Name of the replacement policy: "clock", "lru" or "2q". */
+extern const char * buffer_cache_policy;
 
 void buffer_cache_init (void);
 void buffer_cache_remove (disk_sector_t sector);
-bool buffer_cache_read (disk_sector_t sector, disk_sector_t next, off_t offset,
-                        size_t length, void * buffer);
+void buffer_cache_remove_range (disk_sector_t start, size_t cnt);
+bool buffer_cache_read (disk_sector_t sector, off_t offset, size_t length,
+                        void * buffer);
+bool buffer_cache_read_ahead (disk_sector_t sector);
+const void * buffer_cache_pin (disk_sector_t sector);
+void buffer_cache_unpin (const void * data);
 bool buffer_cache_write (disk_sector_t sector, off_t offset, size_t length,
                          const void * buffer, bool zero);
 void buffer_cache_done (void);
+void buffer_cache_get_stats (struct cache_stats * stats);
+void buffer_cache_print_stats (void);
 
 #endif  /* FILESYS_CACHE_H */
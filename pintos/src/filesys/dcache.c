@@ -0,0 +1,159 @@
+#include "filesys/dcache.h"
+#include <debug.h>
+#include <hash.h>
+#include <list.h>
+#include <string.h>
+#include "filesys/directory.h"
+#include "threads/synch.h"
+
+/* Number of entries the directory entry cache holds. */
+#define DCACHE_SIZE 256
+/* Number of buckets of its index. Must be a power of 2. */
+#define DCACHE_BUCKETS 128
+
+/* What a directory holds, or does not hold, under a name. Path walks
+ * find each component here before reading the directory, so that
+ * resolving a path that was resolved recently reads no directory data.
+ * Entries are kept up to date by dir_add and dir_remove, which call
+ * dcache_insert under the directory's lock. */
+struct dentry
+  {
+    struct list_elem hash_elem;         /* Element in a bucket. */
+    struct list_elem lru_elem;          /* Element in dcache_lru. */
+    bool in_use;                        /* False if the entry is free. */
+    disk_sector_t parent;               /* Inode of the directory. */
+    char name[NAME_MAX + 1];            /* Name in the directory. */
+    disk_sector_t child;                /* Inode named, 0 if none. */
+    bool is_dir;                        /* True if CHILD is a directory. */
+  };
+
+static struct dentry dcache_entries[DCACHE_SIZE];
+/* Entries in use hashed by parent and name. */
+static struct list dcache_buckets[DCACHE_BUCKETS];
+/* Every entry, least recently used first. Free ones are kept in
+ * front, so they are reused first. */
+static struct list dcache_lru;
+/* Protects everything above. */
+static struct lock dcache_lock;
+
+/* Returns the bucket where the entry for NAME in PARENT belongs. */
+static struct list *
+dcache_bucket (disk_sector_t parent, const char *name)
+{
+  unsigned hash = hash_string (name) ^ hash_int (parent);
+  return &dcache_buckets[hash & (DCACHE_BUCKETS - 1)];
+}
+
+/* Returns the entry for NAME in PARENT, or a null pointer if there is
+ * none. DCACHE_LOCK must be held. */
+static struct dentry *
+dcache_find (disk_sector_t parent, const char *name)
+{
+  struct list *bucket = dcache_bucket (parent, name);
+  struct list_elem *e;
+  for (e = list_begin (bucket); e != list_end (bucket); e = list_next (e))
+    {
+      struct dentry *d = list_entry (e, struct dentry, hash_elem);
+      if (d->parent == parent && !strcmp (d->name, name))
+        return d;
+    }
+  return NULL;
+}
+
+/* Frees entry D. DCACHE_LOCK must be held. */
+static void
+dcache_free (struct dentry *d)
+{
+  d->in_use = false;
+  list_remove (&d->hash_elem);
+  list_remove (&d->lru_elem);
+  list_push_front (&dcache_lru, &d->lru_elem);
+}
+
+/* Initializes the directory entry cache. */
+void
+dcache_init (void)
+{
+  size_t i;
+  lock_init (&dcache_lock);
+  list_init (&dcache_lru);
+  for (i = 0; i < DCACHE_BUCKETS; i++)
+    list_init (&dcache_buckets[i]);
+  for (i = 0; i < DCACHE_SIZE; i++)
+    {
+      dcache_entries[i].in_use = false;
+      list_push_back (&dcache_lru, &dcache_entries[i].lru_elem);
+    }
+}
+
+/* Looks up NAME in directory PARENT. If the cache knows PARENT has an
+ * entry NAME, stores the inode it names into *CHILD and whether it is a
+ * directory into *IS_DIR. */
+enum dcache_result
+dcache_lookup (disk_sector_t parent, const char *name,
+               disk_sector_t *child, bool *is_dir)
+{
+  enum dcache_result result = DCACHE_MISS;
+  struct dentry *d;
+  lock_acquire (&dcache_lock);
+  d = dcache_find (parent, name);
+  if (d != NULL)
+    {
+      list_remove (&d->lru_elem);
+      list_push_back (&dcache_lru, &d->lru_elem);
+      if (d->child == 0)
+        result = DCACHE_ABSENT;
+      else
+        {
+          *child = d->child;
+          *is_dir = d->is_dir;
+          result = DCACHE_FOUND;
+        }
+    }
+  lock_release (&dcache_lock);
+  return result;
+}
+
+/* Records that NAME in directory PARENT names inode CHILD, a directory
+ * if IS_DIR is true, or that PARENT has no entry NAME if CHILD is 0.
+ * The caller must hold PARENT's directory lock, so that the entry does
+ * not race with changes to the directory. */
+void
+dcache_insert (disk_sector_t parent, const char *name, disk_sector_t child,
+               bool is_dir)
+{
+  struct dentry *d;
+  if (strlen (name) > NAME_MAX)
+    return;
+  lock_acquire (&dcache_lock);
+  d = dcache_find (parent, name);
+  if (d == NULL)
+    {
+      /* Reuse the least recently used entry. */
+      d = list_entry (list_front (&dcache_lru), struct dentry, lru_elem);
+      if (d->in_use)
+        list_remove (&d->hash_elem);
+      d->in_use = true;
+      d->parent = parent;
+      strlcpy (d->name, name, sizeof d->name);
+      list_push_back (dcache_bucket (parent, name), &d->hash_elem);
+    }
+  d->child = child;
+  d->is_dir = is_dir;
+  list_remove (&d->lru_elem);
+  list_push_back (&dcache_lru, &d->lru_elem);
+  lock_release (&dcache_lock);
+}
+
+/* Forgets every entry of directory DIR, which is being removed, so that
+ * none of them applies to a directory that reuses its sector. */
+void
+dcache_forget_dir (disk_sector_t dir)
+{
+  size_t i;
+  lock_acquire (&dcache_lock);
+  for (i = 0; i < DCACHE_SIZE; i++)
+    if (dcache_entries[i].in_use && dcache_entries[i].parent == dir)
+      dcache_free (&dcache_entries[i]);
+  lock_release (&dcache_lock);
+}
@@ -0,0 +1,22 @@
+#ifndef FILESYS_DCACHE_H
+#define FILESYS_DCACHE_H
+
+#include <stdbool.h>
+#include "devices/disk.h"
+
+/* Result of a lookup in the directory entry cache. */
+enum dcache_result
+  {
+    DCACHE_MISS,                        /* Nothing known, read the dir. */
+    DCACHE_FOUND,                       /* The entry exists. */
+    DCACHE_ABSENT                       /* The entry does not exist. */
+  };
+
+void dcache_init (void);
+enum dcache_result dcache_lookup (disk_sector_t parent, const char *name,
+                                  disk_sector_t *child, bool *is_dir);
+void dcache_insert (disk_sector_t parent, const char *name,
+                    disk_sector_t child, bool is_dir);
+void dcache_forget_dir (disk_sector_t dir);
+
+#endif /* filesys/dcache.h */
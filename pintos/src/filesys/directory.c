@@ -1,7 +1,11 @@
 #include "filesys/directory.h"
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <hash.h>
 #include <list.h>
+#include <round.h>
+#include "filesys/dcache.h"
 #include "filesys/filesys.h"
 #include "filesys/inode.h"
 #include "threads/malloc.h"
@@ -12,6 +16,8 @@ struct dir
   {
     struct inode *inode;                /* Backing store. */
     off_t pos;                          /* Current position. */
+    bool indexed;                       /* Seen to be indexed, so POS is
+                                           in the leaves. */
   };
 
 /* A single directory entry. */
@@ -23,6 +29,279 @@ struct dir_entry
     bool is_dir;                        /* True if directory. */
   };
 
+/* A directory starts out as an array of entries that is searched from
+   the start. Once it has DIR_INDEX_THRESHOLD slots, all of them in use,
+   it is converted to an indexed directory:
+
+   - The first DIR_INDEX_SECTORS sectors hold the index: a header and
+     entries sorted by hash, each giving the first hash a leaf holds.
+   - The sectors after them are leaves of DIR_LEAF_ENTRIES entries. A
+     name lives in the leaf of the last index entry whose hash is not
+     greater than the hash of the name.
+   - A full leaf is split in two at the median hash.
+
+   Finding a name then reads the index and a single leaf. The header
+   takes the place of the entry for "." of an array directory. The
+   sector it would point to is the directory itself, so it never looks
+   like the magic number. */
+#define DIR_INDEX_MAGIC 0x58444e49
+#define DIR_INDEX_THRESHOLD 64
+#define DIR_INDEX_SECTORS 16
+#define DIR_INDEX_SIZE (DIR_INDEX_SECTORS * DISK_SECTOR_SIZE)
+#define DIR_LEAF_ENTRIES (DISK_SECTOR_SIZE / sizeof (struct dir_entry))
+/* Entries per leaf when a directory is converted, leaving room to
+   grow before the first splits. */
+#define DIR_LEAF_FILL (DIR_LEAF_ENTRIES * 2 / 3)
+
+/* Header of the index of an indexed directory. */
+struct dir_index_header
+  {
+    uint32_t magic;                     /* DIR_INDEX_MAGIC. */
+    uint32_t cnt;                       /* Number of index entries. */
+  };
+
+/* Entry of the index of an indexed directory. */
+struct dir_index_entry
+  {
+    uint32_t hash;                      /* Lowest hash in the leaf. */
+    uint32_t block;                     /* Leaf's block in the file. */
+  };
+
+/* Number of index entries the index has room for. */
+#define DIR_INDEX_MAX ((DIR_INDEX_SIZE - sizeof (struct dir_index_header)) \
+                       / sizeof (struct dir_index_entry))
+
+/* Returns the hash of NAME. */
+static unsigned
+dir_hash (const char *name)
+{
+  return hash_string (name);
+}
+
+/* Orders directory entries by the hash of their names, for qsort. */
+static int
+dir_entry_compare (const void *a_, const void *b_)
+{
+  unsigned a = dir_hash (((const struct dir_entry *) a_)->name);
+  unsigned b = dir_hash (((const struct dir_entry *) b_)->name);
+  return a < b ? -1 : a > b;
+}
+
+/* Reads the index header of DIR into *H. Returns true if DIR is an
+   indexed directory. */
+static bool
+dir_index_header (const struct dir *dir, struct dir_index_header *h)
+{
+  return inode_read_at (dir->inode, h, sizeof *h, 0) == sizeof *h
+         && h->magic == DIR_INDEX_MAGIC;
+}
+
+/* Returns the byte offset of index entry I. */
+static off_t
+dir_index_offset (size_t i)
+{
+  return sizeof (struct dir_index_header)
+         + i * sizeof (struct dir_index_entry);
+}
+
+/* Finds the index entry of the leaf of indexed directory DIR, with
+   index header H, where names with hash HASH belong. Stores it into
+   *IE and returns its position in the index. */
+static size_t
+dir_index_find (const struct dir *dir, const struct dir_index_header *h,
+                unsigned hash, struct dir_index_entry *ie)
+{
+  size_t lo = 0, hi = h->cnt;
+  /* The first entry has hash 0, so the result is never before it. */
+  while (hi - lo > 1)
+    {
+      size_t mid = (lo + hi) / 2;
+      if (inode_read_at (dir->inode, ie, sizeof *ie, dir_index_offset (mid))
+          != sizeof *ie)
+        break;
+      if (ie->hash <= hash)
+        lo = mid;
+      else
+        hi = mid;
+    }
+  inode_read_at (dir->inode, ie, sizeof *ie, dir_index_offset (lo));
+  return lo;
+}
+
+/* Returns the byte offset of slot SLOT of leaf BLOCK. */
+static off_t
+dir_leaf_offset (uint32_t block, size_t slot)
+{
+  return block * DISK_SECTOR_SIZE + slot * sizeof (struct dir_entry);
+}
+
+/* Writes the CNT entries of ENTRIES to leaf BLOCK of DIR, and clears
+   the other slots. Returns true if successful. */
+static bool
+dir_leaf_write (struct dir *dir, uint32_t block,
+                const struct dir_entry *entries, size_t cnt)
+{
+  /* A whole sector, so that the slack after the last slot is cleared
+     too. */
+  struct dir_entry *leaf = calloc (1, DISK_SECTOR_SIZE);
+  bool success;
+  ASSERT (cnt <= DIR_LEAF_ENTRIES);
+  if (leaf == NULL)
+    return false;
+  memcpy (leaf, entries, cnt * sizeof *leaf);
+  success = inode_write_at (dir->inode, leaf, DISK_SECTOR_SIZE,
+                            dir_leaf_offset (block, 0)) == DISK_SECTOR_SIZE;
+  free (leaf);
+  return success;
+}
+
+/* Converts array directory DIR, all of whose slots are in use, to an
+   indexed directory. Returns false if it cannot be converted, leaving
+   it an array directory. */
+static bool
+dir_index_convert (struct dir *dir)
+{
+  size_t slots = inode_length (dir->inode) / sizeof (struct dir_entry);
+  struct dir_entry *entries;
+  struct dir_index_header *h;
+  struct dir_index_entry *index;
+  size_t cnt = 0, i, first;
+  bool success;
+
+  /* The index is written over the entries, once they are in leaves. */
+  if (slots * sizeof (struct dir_entry) > DIR_INDEX_SIZE)
+    return false;
+  entries = malloc (slots * sizeof *entries);
+  h = malloc (DIR_INDEX_SIZE);
+  index = (struct dir_index_entry *) (h + 1);
+  success = entries != NULL && h != NULL;
+  for (i = 0; success && i < slots; i++)
+    if (inode_read_at (dir->inode, &entries[cnt], sizeof *entries,
+                       i * sizeof *entries) != sizeof *entries)
+      success = false;
+    else if (entries[cnt].in_use)
+      cnt++;
+  if (success && cnt == 0)
+    success = false;
+  if (success)
+    qsort (entries, cnt, sizeof *entries, dir_entry_compare);
+
+  /* Fill leaves up to DIR_LEAF_FILL entries, never splitting names with
+     the same hash. */
+  if (h != NULL)
+    {
+      h->magic = DIR_INDEX_MAGIC;
+      h->cnt = 0;
+    }
+  for (first = 0; success && first < cnt; first = i)
+    {
+      i = first + 1;
+      while (i < cnt && (i - first < DIR_LEAF_FILL
+                         || dir_hash (entries[i].name)
+                            == dir_hash (entries[i - 1].name)))
+        i++;
+      if (i - first > DIR_LEAF_ENTRIES || h->cnt == DIR_INDEX_MAX)
+        success = false;
+      else
+        {
+          index[h->cnt].hash = h->cnt == 0 ? 0
+                                           : dir_hash (entries[first].name);
+          index[h->cnt].block = DIR_INDEX_SECTORS + h->cnt;
+          success = dir_leaf_write (dir, index[h->cnt].block,
+                                    entries + first, i - first);
+          h->cnt++;
+        }
+    }
+
+  if (success)
+    {
+      off_t size = dir_index_offset (h->cnt);
+      success = inode_write_at (dir->inode, h, size, 0) == size;
+    }
+  free (entries);
+  free (h);
+  return success;
+}
+
+/* Adds entry E to indexed directory DIR, with index header H. The leaf
+   E belongs in is split if it is full. Returns true if successful. */
+static bool
+dir_index_add (struct dir *dir, struct dir_index_header *h,
+               const struct dir_entry *e)
+{
+  struct dir_index_entry ie;
+  struct dir_index_entry *tail = NULL;
+  struct dir_entry *entries = NULL;
+  struct dir_entry slot;
+  size_t pos = dir_index_find (dir, h, dir_hash (e->name), &ie);
+  size_t i, cnt, split, tail_cnt;
+  off_t tail_size;
+  bool success = false;
+
+  /* Use a free slot if the leaf has one. */
+  for (i = 0; i < DIR_LEAF_ENTRIES; i++)
+    if (inode_read_at (dir->inode, &slot, sizeof slot,
+                       dir_leaf_offset (ie.block, i)) != sizeof slot
+        || !slot.in_use)
+      return inode_write_at (dir->inode, e, sizeof *e,
+                             dir_leaf_offset (ie.block, i)) == sizeof *e;
+
+  /* Split the leaf in two at the median hash, keeping names with the
+     same hash together. */
+  if (h->cnt == DIR_INDEX_MAX)
+    return false;
+  cnt = DIR_LEAF_ENTRIES + 1;
+  tail_cnt = h->cnt - pos - 1;
+  entries = malloc (cnt * sizeof *entries);
+  tail = malloc ((tail_cnt + 1) * sizeof *tail);
+  if (entries == NULL || tail == NULL)
+    goto done;
+  for (i = 0; i < DIR_LEAF_ENTRIES; i++)
+    if (inode_read_at (dir->inode, &entries[i], sizeof *entries,
+                       dir_leaf_offset (ie.block, i)) != sizeof *entries)
+      goto done;
+  entries[DIR_LEAF_ENTRIES] = *e;
+  qsort (entries, cnt, sizeof *entries, dir_entry_compare);
+  for (split = cnt / 2;
+       split < cnt && dir_hash (entries[split].name)
+                      == dir_hash (entries[split - 1].name);
+       split++)
+    continue;
+  if (split == cnt)
+    for (split = cnt / 2;
+         split > 0 && dir_hash (entries[split].name)
+                      == dir_hash (entries[split - 1].name);
+         split--)
+      continue;
+  if (split == 0)
+    goto done;
+
+  /* The upper half moves to a new leaf at the end of the file, which
+     is a whole number of sectors. */
+  tail[0].hash = dir_hash (entries[split].name);
+  tail[0].block = DIV_ROUND_UP (inode_length (dir->inode), DISK_SECTOR_SIZE);
+  if (!dir_leaf_write (dir, tail[0].block, entries + split, cnt - split)
+      || !dir_leaf_write (dir, ie.block, entries, split))
+    goto done;
+
+  /* Insert the new leaf into the index right after the split one. */
+  tail_size = tail_cnt * sizeof *tail;
+  if (inode_read_at (dir->inode, tail + 1, tail_size,
+                     dir_index_offset (pos + 1)) != tail_size)
+    goto done;
+  tail_size += sizeof *tail;
+  if (inode_write_at (dir->inode, tail, tail_size,
+                      dir_index_offset (pos + 1)) != tail_size)
+    goto done;
+  h->cnt++;
+  success = inode_write_at (dir->inode, h, sizeof *h, 0) == sizeof *h;
+
+ done:
+  free (entries);
+  free (tail);
+  return success;
+}
+
 /* Creates a directory with space for ENTRY_CNT entries in the
    given SECTOR.  Returns true if successful, false on failure. */
 bool
@@ -33,6 +312,9 @@ dir_create (disk_sector_t sector, disk_sector_t parent, size_t entry_cnt)
   bool success = true;
   if (!inode_create (sector, entry_cnt * sizeof (struct dir_entry), TYPE_DIR))
     return false;
+  /* A process whose working directory was removed from this sector may
+     have looked names up in it since. */
+  dcache_forget_dir (sector);
   inode = inode_open (sector);
   dir = dir_open (inode);
   if (dir == NULL || !dir_add (dir, ".", true, sector)
@@ -56,6 +338,7 @@ dir_open (struct inode *inode)
     {
       dir->inode = inode;
       dir->pos = 0;
+      dir->indexed = false;
       return dir;
     }
   else
@@ -114,15 +397,34 @@ lookup (const struct dir *dir, const char *name,
         struct dir_entry *ep, off_t *ofsp, bool * is_dir) 
 {
   struct dir_entry e;
+  struct dir_index_header h;
+  struct dir_index_entry ie;
   size_t ofs;
+  size_t slot;
   
   ASSERT (dir != NULL);
   ASSERT (name != NULL);
 
+  /* In an indexed directory, only one leaf can hold NAME. */
+  if (dir_index_header (dir, &h))
+    {
+      dir_index_find (dir, &h, dir_hash (name), &ie);
+      for (slot = 0; slot < DIR_LEAF_ENTRIES; slot++)
+        {
+          ofs = dir_leaf_offset (ie.block, slot);
+          if (inode_read_at (dir->inode, &e, sizeof e, ofs) != sizeof e)
+            break;
+          if (e.in_use && !strcmp (name, e.name))
+            goto found;
+        }
+      return false;
+    }
+
   for (ofs = 0; inode_read_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
        ofs += sizeof e) 
     if (e.in_use && !strcmp (name, e.name)) 
       {
+      found:
         if (ep != NULL)
           *ep = e;
         if (ofsp != NULL)
@@ -142,15 +444,42 @@ dir_lookup (const struct dir *dir, const char *name,
             struct inode **inode, bool * is_dir) 
 {
   struct dir_entry e;
+  disk_sector_t parent;
+  disk_sector_t child;
+  bool removed;
 
   ASSERT (dir != NULL);
   ASSERT (name != NULL);
 
+  /* Recently resolved names are answered without reading DIR. What a
+     removed directory holds is not cached: its entries were forgotten
+     when it was removed, under its lock, and must stay so. */
+  parent = inode_get_inumber (dir->inode);
   inode_dir_lock (dir->inode);
-  if (lookup (dir, name, &e, NULL, is_dir))
-    *inode = inode_open (e.inode_sector);
-  else
-    *inode = NULL;
+  switch (dcache_lookup (parent, name, &child, is_dir))
+    {
+    case DCACHE_FOUND:
+      *inode = inode_open (child);
+      break;
+    case DCACHE_ABSENT:
+      *inode = NULL;
+      break;
+    case DCACHE_MISS:
+      removed = inode_is_removed (dir->inode);
+      if (lookup (dir, name, &e, NULL, is_dir))
+        {
+          if (!removed)
+            dcache_insert (parent, name, e.inode_sector, *is_dir);
+          *inode = inode_open (e.inode_sector);
+        }
+      else
+        {
+          if (!removed)
+            dcache_insert (parent, name, 0, false);
+          *inode = NULL;
+        }
+      break;
+    }
   inode_dir_unlock (dir->inode);
 
   return *inode != NULL;
@@ -167,6 +496,7 @@ dir_add (struct dir *dir, const char *name, bool is_dir,
          disk_sector_t inode_sector)
 {
   struct dir_entry e;
+  struct dir_index_header h;
   off_t ofs;
   bool success = false;
   bool temp;
@@ -183,6 +513,16 @@ dir_add (struct dir *dir, const char *name, bool is_dir,
   if (lookup (dir, name, NULL, NULL, &temp))
     goto done;
 
+  e.in_use = true;
+  e.is_dir = is_dir;
+  strlcpy (e.name, name, sizeof e.name);
+  e.inode_sector = inode_sector;
+  if (dir_index_header (dir, &h))
+    {
+      success = dir_index_add (dir, &h, &e);
+      goto done;
+    }
+
   /* Set OFS to offset of free slot.
      If there are no free slots, then it will be set to the
      current end-of-file.
@@ -190,19 +530,30 @@ dir_add (struct dir *dir, const char *name, bool is_dir,
      inode_read_at() will only return a short read at end of file.
      Otherwise, we'd need to verify that we didn't get a short
      read due to something intermittent such as low memory. */
-  for (ofs = 0; inode_read_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
-       ofs += sizeof e) 
-    if (!e.in_use)
+  struct dir_entry slot;
+  for (ofs = 0;
+       inode_read_at (dir->inode, &slot, sizeof slot, ofs) == sizeof slot;
+       ofs += sizeof slot) 
+    if (!slot.in_use)
       break;
 
+  /* A full directory that is large enough gets an index instead of
+     growing by one slot. */
+  if (ofs >= (off_t) (DIR_INDEX_THRESHOLD * sizeof e)
+      && ofs == inode_length (dir->inode) && dir_index_convert (dir)
+      && dir_index_header (dir, &h))
+    {
+      success = dir_index_add (dir, &h, &e);
+      goto done;
+    }
+
   /* Write slot. */
-  e.in_use = true;
-  e.is_dir = is_dir;
-  strlcpy (e.name, name, sizeof e.name);
-  e.inode_sector = inode_sector;
   success = inode_write_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
 
  done:
+  if (success)
+    dcache_insert (inode_get_inumber (dir->inode), name, inode_sector,
+                   is_dir);
   inode_dir_unlock (dir->inode);
   return success;
 }
@@ -250,13 +601,11 @@ dir_remove (struct dir *dir, const char *name)
   {
     if (inode_is_opened (inode))
       goto done;
-    struct dir * target = dir_open (inode);
-    if (!dir_is_empty (target))
-    {
-      dir_close (target);
-      inode = NULL;         /* Prevent double closing the inode. */
+    struct dir * target = dir_open (inode_reopen (inode));
+    bool empty = target != NULL && dir_is_empty (target);
+    dir_close (target);
+    if (!empty)
       goto done;
-    }
   }
 
   /* Erase directory entry. */
@@ -264,8 +613,19 @@ dir_remove (struct dir *dir, const char *name)
   if (inode_write_at (dir->inode, &e, sizeof e, ofs) != sizeof e) 
     goto done;
 
-  /* Remove inode. */
-  inode_remove (inode);
+  /* Remove inode. A directory is removed and forgotten under its own
+     lock, so that a lookup in it either caches before it is forgotten
+     or sees it removed. */
+  dcache_insert (inode_get_inumber (dir->inode), name, 0, false);
+  if (is_dir)
+    {
+      inode_dir_lock (inode);
+      inode_remove (inode);
+      dcache_forget_dir (e.inode_sector);
+      inode_dir_unlock (inode);
+    }
+  else
+    inode_remove (inode);
   success = true;
 
  done:
@@ -274,6 +634,30 @@ dir_remove (struct dir *dir, const char *name)
   return success;
 }
 
+/* Reads the entry at DIR's position into *E and advances past it,
+   skipping the index and the ends of leaves of an indexed directory.
+   Returns false at the end of DIR. The header is read only until the
+   directory is seen to be indexed: a directory may become indexed
+   while it is read, but never goes back, and until then it is small. */
+static bool
+dir_read_next (struct dir *dir, struct dir_entry *e)
+{
+  struct dir_index_header h;
+  if (!dir->indexed && dir_index_header (dir, &h))
+    {
+      dir->indexed = true;
+      if (dir->pos < DIR_INDEX_SIZE)
+        dir->pos = DIR_INDEX_SIZE;
+    }
+  if (dir->indexed
+      && dir->pos % DISK_SECTOR_SIZE + sizeof *e > DISK_SECTOR_SIZE)
+    dir->pos = ROUND_UP (dir->pos, DISK_SECTOR_SIZE);
+  if (inode_read_at (dir->inode, e, sizeof *e, dir->pos) != sizeof *e)
+    return false;
+  dir->pos += sizeof *e;
+  return true;
+}
+
 /* Reads the next directory entry in DIR and stores the name in
    NAME.  Returns true if successful, false if the directory
    contains no more entries. */
@@ -283,9 +667,8 @@ dir_readdir (struct dir *dir, char name[NAME_MAX + 1])
   struct dir_entry e;
 
   inode_dir_lock (dir->inode);
-  while (inode_read_at (dir->inode, &e, sizeof e, dir->pos) == sizeof e) 
+  while (dir_read_next (dir, &e))
     {
-      dir->pos += sizeof e;
       /* Ignore . and .. */
       if (strcmp (e.name, ".") == 0 || strcmp (e.name, "..") == 0)
         continue;
@@ -307,9 +690,8 @@ dir_is_empty (struct dir *dir)
   struct dir_entry e;
 
   inode_dir_lock (dir->inode);
-  while (inode_read_at (dir->inode, &e, sizeof e, dir->pos) == sizeof e) 
+  while (dir_read_next (dir, &e))
     {
-      dir->pos += sizeof e;
       /* Ignore . and .. */
       if (strcmp (e.name, ".") == 0 || strcmp (e.name, "..") == 0)
         continue;
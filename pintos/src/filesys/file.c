@@ -10,6 +10,7 @@ struct file
     struct inode *inode;        /* File's inode. */
     off_t pos;                  /* Current position. */
     bool deny_write;            /* Has file_deny_write() been called? */
+    struct read_ahead ra;       /* Sequential access detection. */
   };
 
 /* Opens a file for the given INODE, of which it takes ownership,
@@ -24,6 +25,7 @@ file_open (struct inode *inode)
       file->inode = inode;
       file->pos = 0;
       file->deny_write = false;
+      inode_read_ahead_init (&file->ra);
       return file;
     }
   else
@@ -69,7 +71,8 @@ file_get_inode (struct file *file)
 off_t
 file_read (struct file *file, void *buffer, off_t size) 
 {
-  off_t bytes_read = inode_read_at (file->inode, buffer, size, file->pos);
+  off_t bytes_read = inode_read_ahead_at (file->inode, buffer, size,
+                                         file->pos, &file->ra);
   file->pos += bytes_read;
   return bytes_read;
 }
@@ -82,7 +85,7 @@ file_read (struct file *file, void *buffer, off_t size)
 off_t
 file_read_at (struct file *file, void *buffer, off_t size, off_t file_ofs) 
 {
-  return inode_read_at (file->inode, buffer, size, file_ofs);
+  return inode_read_ahead_at (file->inode, buffer, size, file_ofs, &file->ra);
 }
 
 /* Writes SIZE bytes from BUFFER into FILE,
@@ -114,6 +117,38 @@ file_write_at (struct file *file, const void *buffer, off_t size,
   return inode_write_at (file->inode, buffer, size, file_ofs);
 }
 
+/* Sets the size of FILE to LENGTH bytes, freeing the blocks past the new
+   end if it shrinks. Bytes added by growing it read as zeros.
+   Returns false if writes to FILE are denied. */
+bool
+file_truncate (struct file *file, off_t length)
+{
+  ASSERT (file != NULL);
+  return inode_truncate (file->inode, length);
+}
+
+/* Allocates disk space for the LEN bytes of FILE starting at offset
+   FILE_OFS, growing it if they extend past its end.
+   Returns false if writes to FILE are denied or the disk is full.
+   The file's current position is unaffected. */
+bool
+file_allocate (struct file *file, off_t file_ofs, off_t len)
+{
+  ASSERT (file != NULL);
+  return inode_allocate (file->inode, file_ofs, len);
+}
+
+/* Allocates disk space for the first LENGTH bytes of FILE in
+   advance, without changing its size, so that writing them later
+   does not fragment it.
+   Returns false if writes to FILE are denied or the disk is full. */
+bool
+file_reserve (struct file *file, off_t length)
+{
+  ASSERT (file != NULL);
+  return inode_reserve (file->inode, length);
+}
+
 /* Prevents write operations on FILE's underlying inode
    until file_allow_write() is called or FILE is closed. */
 void
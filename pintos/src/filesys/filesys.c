@@ -9,6 +9,7 @@
 #include "filesys/inode.h"
 #include "filesys/directory.h"
 #include "filesys/cache.h"
+#include "filesys/dcache.h"
 #include "devices/disk.h"
 
 /* The disk that contains the file system. */
@@ -26,6 +27,7 @@ filesys_init (bool format)
     PANIC ("hd0:1 (hdb) not present, file system initialization failed");
 
   inode_init ();
+  dcache_init ();
   free_map_init ();
 
   buffer_cache_init ();
@@ -187,8 +189,11 @@ filesys_create (const char *name_, off_t initial_size)
   char name[NAME_MAX + 1];          /* Place to store name of file. */
   struct dir * dir = filesys_create_routine (name_, name);
   disk_sector_t inode_sector = 0;
+  /* Next to the directory, in its allocation group. */
   bool success = (dir != NULL
-                  && free_map_allocate (1, &inode_sector)
+                  && free_map_allocate_near (1,
+                                  inode_get_inumber (dir_get_inode (dir)),
+                                  &inode_sector)
                   && inode_create (inode_sector, initial_size, TYPE_FILE)
                   && dir_add (dir, name, false, inode_sector));
   if (!success && inode_sector != 0) 
@@ -227,8 +232,10 @@ filesys_mkdir (const char * name_)
   char name[NAME_MAX + 1];
   struct dir * dir = filesys_create_routine (name_, name);
   disk_sector_t inode_sector = 0;
+  /* Directories are spread over the allocation groups. */
   bool success = (dir != NULL
-                  && free_map_allocate (1, &inode_sector)
+                  && free_map_allocate_near (1, free_map_emptiest_group (),
+                                             &inode_sector)
                   && dir_create (inode_sector,
                                  inode_get_inumber(dir_get_inode(dir)), 16)
                   && dir_add (dir, name, true, inode_sector));
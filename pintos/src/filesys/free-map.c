@@ -1,14 +1,234 @@
 #include "filesys/free-map.h"
 #include <bitmap.h>
 #include <debug.h>
+#include <round.h>
+#include <stdio.h>
 #include "filesys/file.h"
 #include "filesys/filesys.h"
 #include "filesys/inode.h"
+#include "threads/malloc.h"
 #include "threads/synch.h"
 
 static struct file *free_map_file;    /* Free map file. */
 static struct bitmap *free_map;       /* Free map, one bit per disk sector. */
 static struct lock free_map_lock;     /* Free map lock. */
+/* Sectors of the free map file that differ from the free map, one bit
+   per sector. Changes to the free map only mark the sectors they
+   touch, and free_map_flush writes just those. Protected by
+   FREE_MAP_LOCK. */
+static struct bitmap *free_map_dirty;
+/* Serializes free_map_flush, so that an older image of a sector of
+   the free map is never written after a newer one, and protects
+   FREE_MAP_FILE. Allocations only wait for FREE_MAP_LOCK, which is
+   not held while the file is written. */
+static struct lock free_map_flush_lock;
+
+/* Number of bits of the free map one sector of its file holds. */
+#define BITS_PER_SECTOR (DISK_SECTOR_SIZE * 8)
+/* Number of allocation groups the disk is divided into. Directories
+   are spread over the groups, and the files in a directory are kept
+   in its group. */
+#define FREE_MAP_GROUPS 8
+
+/* Where the next allocation without a goal starts looking, just past
+   the previous one, so that allocations do not rescan the full start
+   of the disk. Protected by FREE_MAP_LOCK. */
+static disk_sector_t free_map_cursor;
+
+/* Index of the free space, kept in memory alongside the free map,
+   which remains the format on disk. It is a segment tree over the
+   free map: node 1 covers the whole disk, the children of node K are
+   nodes 2K and 2K + 1, each covering half of it, and the leaves cover
+   FREE_INDEX_LEAF sectors each. Every node records the runs of free
+   sectors at its two ends and the longest one inside it, which finds
+   a run of a given length in logarithmic time, and how many sectors
+   and runs are free inside it, which counts the free sectors of any
+   part of the disk as fast. Sectors past the end of the disk count
+   as used. Protected by FREE_MAP_LOCK. */
+struct free_index_node
+  {
+    size_t prefix;                      /* Free sectors at the start. */
+    size_t suffix;                      /* Free sectors at the end. */
+    size_t longest;                     /* Longest run of free sectors. */
+    size_t free;                        /* Free sectors. */
+    size_t runs;                        /* Runs of free sectors. */
+  };
+
+/* Number of sectors a leaf covers. */
+#define FREE_INDEX_LEAF 32
+
+static struct free_index_node *free_index;
+static size_t free_index_leaves;      /* Always a power of 2. */
+
+/* Recomputes leaf LEAF of the free index from the free map. */
+static void
+free_index_leaf (size_t leaf)
+{
+  struct free_index_node *node = &free_index[free_index_leaves + leaf];
+  size_t size = bitmap_size (free_map);
+  size_t run = 0;
+  size_t i;
+  bool at_start = true;
+  node->prefix = node->longest = node->free = node->runs = 0;
+  for (i = leaf * FREE_INDEX_LEAF; i < (leaf + 1) * FREE_INDEX_LEAF; i++)
+    {
+      if (i < size && !bitmap_test (free_map, i))
+        {
+          if (run++ == 0)
+            node->runs++;
+          if (run > node->longest)
+            node->longest = run;
+          node->free++;
+        }
+      else
+        {
+          run = 0;
+          at_start = false;
+        }
+      if (at_start)
+        node->prefix = run;
+    }
+  node->suffix = run;
+}
+
+/* Recomputes inner node K of the free index, whose children cover
+   HALF sectors each, from its children. */
+static void
+free_index_combine (size_t k, size_t half)
+{
+  const struct free_index_node *l = &free_index[2 * k];
+  const struct free_index_node *r = &free_index[2 * k + 1];
+  struct free_index_node *node = &free_index[k];
+  node->prefix = l->prefix == half ? half + r->prefix : l->prefix;
+  node->suffix = r->suffix == half ? half + l->suffix : r->suffix;
+  node->longest = l->longest > r->longest ? l->longest : r->longest;
+  if (l->suffix + r->prefix > node->longest)
+    node->longest = l->suffix + r->prefix;
+  node->free = l->free + r->free;
+  node->runs = l->runs + r->runs - (l->suffix > 0 && r->prefix > 0);
+}
+
+/* Brings the free index up to date with the free map for the CNT
+   sectors starting at SECTOR. Takes time proportional to CNT plus
+   the height of the tree. */
+static void
+free_index_update (disk_sector_t sector, size_t cnt)
+{
+  size_t lo = sector / FREE_INDEX_LEAF;
+  size_t hi = (sector + cnt - 1) / FREE_INDEX_LEAF;
+  size_t half = FREE_INDEX_LEAF;
+  size_t k;
+  if (cnt == 0)
+    return;
+  for (k = lo; k <= hi; k++)
+    free_index_leaf (k);
+  for (lo = (free_index_leaves + lo) / 2, hi = (free_index_leaves + hi) / 2;
+       lo > 0; lo /= 2, hi /= 2, half *= 2)
+    for (k = lo; k <= hi; k++)
+      free_index_combine (k, half);
+}
+
+/* Builds the free index for the whole free map. */
+static void
+free_index_build (void)
+{
+  size_t leaves = DIV_ROUND_UP (bitmap_size (free_map), FREE_INDEX_LEAF);
+  for (free_index_leaves = 1; free_index_leaves < leaves;
+       free_index_leaves *= 2)
+    continue;
+  free_index = malloc (2 * free_index_leaves * sizeof *free_index);
+  if (free_index == NULL)
+    PANIC ("free index creation failed--disk is too large");
+  free_index_update (0, free_index_leaves * FREE_INDEX_LEAF);
+}
+
+/* Returns the first sector at or after GOAL that starts a run of CNT
+   free sectors, looking only at node K, which covers the SPAN sectors
+   starting at LO, or BITMAP_ERROR if there is none. *RUN is the number
+   of free sectors at or after GOAL that end right before LO, and is
+   updated to the number that end right after the node. */
+static size_t
+free_index_search (size_t k, size_t lo, size_t span, disk_sector_t goal,
+                   size_t cnt, size_t *run)
+{
+  const struct free_index_node *node = &free_index[k];
+  size_t result;
+  if (lo + span <= goal)
+    {
+      *run = 0;
+      return BITMAP_ERROR;
+    }
+  if (lo >= goal)
+    {
+      /* The run may continue into the node. */
+      if (*run + node->prefix >= cnt)
+        return lo - *run;
+      if (node->longest < cnt)
+        {
+          *run = node->prefix == span ? *run + span : node->suffix;
+          return BITMAP_ERROR;
+        }
+    }
+  if (span == FREE_INDEX_LEAF)
+    {
+      size_t size = bitmap_size (free_map);
+      size_t i;
+      for (i = lo > goal ? lo : goal; i < lo + span; i++)
+        if (i < size && !bitmap_test (free_map, i))
+          {
+            if (++*run >= cnt)
+              return i + 1 - cnt;
+          }
+        else
+          *run = 0;
+      return BITMAP_ERROR;
+    }
+  result = free_index_search (2 * k, lo, span / 2, goal, cnt, run);
+  if (result == BITMAP_ERROR)
+    result = free_index_search (2 * k + 1, lo + span / 2, span / 2,
+                                goal, cnt, run);
+  return result;
+}
+
+/* Returns the number of free sectors from START up to but not
+   including END, looking only at node K, which covers the SPAN
+   sectors starting at LO. */
+static size_t
+free_index_count (size_t k, size_t lo, size_t span, size_t start,
+                  size_t end)
+{
+  if (end <= lo || lo + span <= start)
+    return 0;
+  if (start <= lo && lo + span <= end)
+    return free_index[k].free;
+  if (span == FREE_INDEX_LEAF)
+    {
+      size_t size = bitmap_size (free_map);
+      size_t cnt = 0;
+      size_t i;
+      for (i = lo > start ? lo : start; i < lo + span && i < end; i++)
+        if (i < size && !bitmap_test (free_map, i))
+          cnt++;
+      return cnt;
+    }
+  return free_index_count (2 * k, lo, span / 2, start, end)
+         + free_index_count (2 * k + 1, lo + span / 2, span / 2, start,
+                             end);
+}
+
+/* Records that the CNT sectors starting at SECTOR changed in the free
+   map: marks the sectors of the free map file that hold their bits as
+   dirty and updates the free index. FREE_MAP_LOCK must be held. */
+static void
+free_map_changed (disk_sector_t sector, size_t cnt)
+{
+  if (cnt == 0)
+    return;
+  size_t first = sector / BITS_PER_SECTOR;
+  size_t last = (sector + cnt - 1) / BITS_PER_SECTOR;
+  bitmap_set_multiple (free_map_dirty, first, last - first + 1, true);
+  free_index_update (sector, cnt);
+}
 
 /* Initializes the free map. */
 void
@@ -19,33 +239,92 @@ free_map_init (void)
     PANIC ("bitmap creation failed--disk is too large");
   bitmap_mark (free_map, FREE_MAP_SECTOR);
   bitmap_mark (free_map, ROOT_DIR_SECTOR);
+  free_map_dirty = bitmap_create (DIV_ROUND_UP (bitmap_file_size (free_map),
+                                                DISK_SECTOR_SIZE));
+  if (free_map_dirty == NULL)
+    PANIC ("bitmap creation failed--disk is too large");
+  free_index_build ();
   lock_init (&free_map_lock);
+  lock_init (&free_map_flush_lock);
+}
+
+/* Allocates the first CNT consecutive free sectors at or after GOAL,
+   wrapping around to the start of the disk if there are none. The
+   free index finds them without scanning the free map.
+   Returns the first sector, or BITMAP_ERROR if there is no such run.
+   FREE_MAP_LOCK must be held. */
+static size_t
+free_map_scan (size_t cnt, disk_sector_t goal)
+{
+  size_t span = free_index_leaves * FREE_INDEX_LEAF;
+  size_t sector = BITMAP_ERROR;
+  size_t run = 0;
+  if (cnt == 0 || free_index[1].longest < cnt)
+    return BITMAP_ERROR;
+  if (goal < bitmap_size (free_map))
+    sector = free_index_search (1, 0, span, goal, cnt, &run);
+  if (sector == BITMAP_ERROR)
+    {
+      run = 0;
+      sector = free_index_search (1, 0, span, 0, cnt, &run);
+    }
+  ASSERT (sector != BITMAP_ERROR);
+  bitmap_set_multiple (free_map, sector, cnt, true);
+  free_map_changed (sector, cnt);
+  return sector;
 }
 
 /* Allocates CNT consecutive sectors from the free map and stores
-   the first into *SECTORP.
+   the first into *SECTORP. The search starts where the previous
+   one ended.
    Returns true if successful, false if all sectors were
    available. */
 bool
 free_map_allocate (size_t cnt, disk_sector_t *sectorp) 
 {
   lock_acquire (&free_map_lock);
-  disk_sector_t sector = bitmap_scan_and_flip (free_map, 0, cnt, false);
+  size_t sector = free_map_scan (cnt, free_map_cursor);
+  if (sector != BITMAP_ERROR)
+    free_map_cursor = sector + cnt;
   lock_release (&free_map_lock);
-  if (sector != BITMAP_ERROR
-      && free_map_file != NULL
-      && !bitmap_write (free_map, free_map_file))
-    {
-      lock_acquire (&free_map_lock);
-      bitmap_set_multiple (free_map, sector, cnt, false);
-      lock_release (&free_map_lock);
-      sector = BITMAP_ERROR;
-    }
   if (sector != BITMAP_ERROR)
     *sectorp = sector;
   return sector != BITMAP_ERROR;
 }
 
+/* Same as free_map_allocate, but the search starts at GOAL, so that
+   related sectors end up close to each other. */
+bool
+free_map_allocate_near (size_t cnt, disk_sector_t goal,
+                        disk_sector_t *sectorp)
+{
+  lock_acquire (&free_map_lock);
+  size_t sector = free_map_scan (cnt, goal);
+  lock_release (&free_map_lock);
+  if (sector != BITMAP_ERROR)
+    *sectorp = sector;
+  return sector != BITMAP_ERROR;
+}
+
+/* Allocates the CNT consecutive sectors starting at SECTOR if all of
+   them are free.
+   Returns true if successful, false if any of them was in use. */
+bool
+free_map_allocate_at (disk_sector_t sector, size_t cnt)
+{
+  bool success = false;
+  lock_acquire (&free_map_lock);
+  if (sector + cnt <= bitmap_size (free_map)
+      && bitmap_none (free_map, sector, cnt))
+    {
+      bitmap_set_multiple (free_map, sector, cnt, true);
+      free_map_changed (sector, cnt);
+      success = true;
+    }
+  lock_release (&free_map_lock);
+  return success;
+}
+
 /* Makes CNT sectors starting at SECTOR available for use. */
 void
 free_map_release (disk_sector_t sector, size_t cnt)
@@ -54,8 +333,112 @@ free_map_release (disk_sector_t sector, size_t cnt)
   /* This assertion may fail because free_map_allocate resets its bits. */
   // ASSERT (bitmap_all (free_map, sector, cnt));
   bitmap_set_multiple (free_map, sector, cnt, false);
+  free_map_changed (sector, cnt);
+  lock_release (&free_map_lock);
+}
+
+/* Largest number of sectors of the free map written at once. */
+#define FLUSH_SECTORS 8
+
+/* Writes the sectors of the free map that changed since the last call
+   to the free map file, in runs of consecutive sectors. Called by the
+   write behind daemon before each pass and when the free map is
+   closed, so changes reach the disk in batches. Each run is copied
+   and marked clean under FREE_MAP_LOCK, then written without it, so
+   allocations do not wait for the disk. A change made meanwhile marks
+   the sectors dirty again. */
+void
+free_map_flush (void)
+{
+  static uint8_t buf[FLUSH_SECTORS * DISK_SECTOR_SIZE];
+  size_t start = 0, end, size;
+  lock_acquire (&free_map_flush_lock);
+  while (free_map_file != NULL)
+    {
+      lock_acquire (&free_map_lock);
+      start = bitmap_scan (free_map_dirty, start, 1, true);
+      if (start == BITMAP_ERROR)
+        {
+          lock_release (&free_map_lock);
+          break;
+        }
+      end = bitmap_scan (free_map_dirty, start, 1, false);
+      if (end == BITMAP_ERROR)
+        end = bitmap_size (free_map_dirty);
+      if (end - start > FLUSH_SECTORS)
+        end = start + FLUSH_SECTORS;
+      size = bitmap_copy_part (free_map, start * DISK_SECTOR_SIZE,
+                               (end - start) * DISK_SECTOR_SIZE, buf);
+      bitmap_set_multiple (free_map_dirty, start, end - start, false);
+      lock_release (&free_map_lock);
+
+      if (file_write_at (free_map_file, buf, size, start * DISK_SECTOR_SIZE)
+          != (off_t) size)
+        {
+          /* Marked dirty again, to be retried next time. */
+          lock_acquire (&free_map_lock);
+          bitmap_set_multiple (free_map_dirty, start, end - start, true);
+          lock_release (&free_map_lock);
+          break;
+        }
+      start = end;
+    }
+  lock_release (&free_map_flush_lock);
+}
+
+/* Returns the first sector of the allocation group with the most free
+   sectors, where a new directory is best placed. The disk is split
+   into FREE_MAP_GROUPS groups whatever its size, each a whole number
+   of leaves of the free index, which counts their free sectors. */
+disk_sector_t
+free_map_emptiest_group (void)
+{
+  size_t size = bitmap_size (free_map);
+  size_t span = free_index_leaves * FREE_INDEX_LEAF;
+  size_t group = ROUND_UP (DIV_ROUND_UP (size, FREE_MAP_GROUPS),
+                           FREE_INDEX_LEAF);
+  size_t best = 0, best_free = 0;
+  size_t start;
+  lock_acquire (&free_map_lock);
+  for (start = 0; start < size; start += group)
+    {
+      size_t free = free_index_count (1, 0, span, start, start + group);
+      if (free > best_free)
+        {
+          best = start;
+          best_free = free;
+        }
+    }
   lock_release (&free_map_lock);
-  bitmap_write (free_map, free_map_file);
+  return best;
+}
+
+/* Stores statistics about the free space into *STATS. They are read
+   off the root of the free index. */
+void
+free_map_get_stats (struct free_map_stats *stats)
+{
+  lock_acquire (&free_map_lock);
+  stats->sectors = bitmap_size (free_map);
+  stats->free = free_index[1].free;
+  stats->free_runs = free_index[1].runs;
+  stats->largest_run = free_index[1].longest;
+  lock_release (&free_map_lock);
+}
+
+/* Prints free space statistics. Fragmentation is the share of free
+   sectors outside the longest free run: 0% when all free space is
+   in one piece. */
+void
+free_map_print_stats (void)
+{
+  struct free_map_stats stats;
+  free_map_get_stats (&stats);
+  printf ("Free map: %zu of %zu sectors free in %zu runs, "
+          "longest %zu (%zu%% fragmented)\n",
+          stats.free, stats.sectors, stats.free_runs, stats.largest_run,
+          stats.free > 0
+          ? (stats.free - stats.largest_run) * 100 / stats.free : 0);
 }
 
 /* Opens the free map file and reads it from disk. */
@@ -67,13 +450,20 @@ free_map_open (void)
     PANIC ("can't open free map");
   if (!bitmap_read (free_map, free_map_file))
     PANIC ("can't read free map");
+  lock_acquire (&free_map_lock);
+  free_index_update (0, bitmap_size (free_map));
+  lock_release (&free_map_lock);
 }
 
 /* Writes the free map to disk and closes the free map file. */
 void
 free_map_close (void) 
 {
+  free_map_flush ();
+  lock_acquire (&free_map_flush_lock);
   file_close (free_map_file);
+  free_map_file = NULL;
+  lock_release (&free_map_flush_lock);
 }
 
 /* Creates a new free map file on disk and writes the free map to
@@ -91,5 +481,6 @@ free_map_create (void)
     PANIC ("can't open free map");
   if (!bitmap_write (free_map, free_map_file))
     PANIC ("can't write free map");
+  bitmap_set_all (free_map_dirty, false);
 }
 
@@ -3,6 +3,7 @@
 
 #include <stdbool.h>
 #include <stddef.h>
+#include <free-map-stats.h>
 #include "devices/disk.h"
 
 void free_map_init (void);
@@ -12,6 +13,13 @@ void free_map_open (void);
 void free_map_close (void);
 
 bool free_map_allocate (size_t, disk_sector_t *);
+bool free_map_allocate_near (size_t, disk_sector_t goal, disk_sector_t *);
+bool free_map_allocate_at (disk_sector_t, size_t);
 void free_map_release (disk_sector_t, size_t);
+void free_map_flush (void);
+disk_sector_t free_map_emptiest_group (void);
+
+void free_map_get_stats (struct free_map_stats *);
+void free_map_print_stats (void);
 
 #endif /* filesys/free-map.h */
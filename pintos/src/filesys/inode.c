@@ -1,7 +1,9 @@
 #include "filesys/inode.h"
+#include <hash.h>
 #include <list.h>
 #include <debug.h>
 #include <round.h>
+#include <stdint.h>
 #include <string.h>
 #include <stdio.h>
 #include "filesys/cache.h"
@@ -13,8 +15,53 @@
 /* Number of inode pointers. */
 #define DIRECT_BLOCKS 120
 #define SINGLY_INDIRECT_BLOCKS 4
-/* Identifies an inode. */
+/* Number of pointers to sectors an indirect block holds. */
+#define INDIRECT_POINTERS (DISK_SECTOR_SIZE / sizeof (disk_sector_t))
+/* Number of blocks a block map can point to. */
+#define BLOCK_MAP_BLOCKS (DIRECT_BLOCKS + (SINGLY_INDIRECT_BLOCKS \
+                                           + INDIRECT_POINTERS) \
+                                          * INDIRECT_POINTERS)
+/* Number of extents an inode holds. */
+#define INODE_EXTENTS 41
+/* Identifies an inode whose blocks are mapped by pointers. */
 #define INODE_MAGIC 0x494e4f44
+/* Identifies an inode whose blocks are mapped by extents. */
+#define EXTENT_MAGIC 0x494e4f45
+/* Identifies an inode that holds its data itself. */
+#define INLINE_MAGIC 0x494e4f49
+/* Largest file whose data fits in its inode: what is left of the
+ * sector after the type, the length and the magic number. */
+#define INLINE_MAX (DISK_SECTOR_SIZE - 3 * sizeof (uint32_t))
+/* Largest read ahead window in sectors. */
+#define READ_AHEAD_MAX 16
+/* End of a byte range that reaches past any end of file. */
+#define RANGE_EOF INT32_MAX
+
+/* Pointers to the sectors of a file, one per block. Used when a file
+ * is too fragmented to be described by INODE_EXTENTS extents. */
+struct block_map
+  {
+    disk_sector_t direct[DIRECT_BLOCKS];
+    disk_sector_t singly[SINGLY_INDIRECT_BLOCKS];
+    disk_sector_t doubly;
+  };
+
+/* LENGTH consecutive sectors starting at START that hold the blocks of
+ * a file starting at block BLOCK. */
+struct extent
+  {
+    uint32_t block;                     /* First block of the file. */
+    disk_sector_t start;                /* First sector. */
+    uint32_t length;                    /* Number of sectors. */
+  };
+
+/* Extents of a file, sorted by block and not overlapping. Blocks that
+ * no extent covers are not allocated. */
+struct extent_map
+  {
+    uint32_t cnt;                       /* Number of extents in use. */
+    struct extent extents[INODE_EXTENTS];
+  };
 
 /* On-disk inode.
    Must be exactly DISK_SECTOR_SIZE bytes long. */
@@ -22,9 +69,12 @@ struct inode_disk
   {
     uint32_t type;                      /* Type of file.(enum inode_type) */
     off_t length;                       /* File size in bytes. */
-    disk_sector_t block_direct[DIRECT_BLOCKS];
-    disk_sector_t block_singly[SINGLY_INDIRECT_BLOCKS];
-    disk_sector_t block_doubly;
+    union
+      {
+        struct block_map blocks;        /* If MAGIC is INODE_MAGIC. */
+        struct extent_map extents;      /* If MAGIC is EXTENT_MAGIC. */
+        uint8_t data[INLINE_MAX];       /* If MAGIC is INLINE_MAGIC. */
+      } map;
     unsigned magic;                     /* Magic number. */
   };
 
@@ -45,62 +95,170 @@ bytes_to_sectors (off_t size)
   return DIV_ROUND_UP (size, DISK_SECTOR_SIZE);
 }
 
+/* Key of an inode in the table of open inodes, kept apart so that a
+ * lookup does not need a whole inode to search with. */
+struct open_key
+  {
+    struct hash_elem elem;              /* Element in open_inodes. */
+    disk_sector_t sector;               /* Same as the inode's SECTOR. */
+  };
+
 /* In-memory inode. */
 struct inode 
   {
-    struct list_elem elem;              /* Element in inode list. */
+    struct open_key key;                /* Key in open_inodes. */
     disk_sector_t sector;               /* Sector number of disk location. */
-    int open_cnt;                       /* Number of openers. */
+    int open_cnt;                       /* Number of openers. Protected
+                                           by open_inodes_lock. */
     bool removed;                       /* True if deleted, false otherwise. */
     int deny_write_cnt;                 /* 0: writes ok, >0: deny writes. */
     struct lock mutex;                  /* Mutex for metadata. */
     struct lock dir_mutex;              /* Mutex for directories. */
+    struct list ranges;                 /* Locked byte ranges. */
+    struct condition range_released;    /* Signaled when one is unlocked. */
+    /* Copy of the on-disk inode, read when the inode is opened. It is
+     * authoritative while the inode is open, and every change to it is
+     * written back to the buffer cache. Protected by MUTEX. */
+    union
+      {
+        struct inode_disk disk;         /* Any other inode. */
+        struct inode_disk_0 disk_0;     /* FREE_MAP_SECTOR. */
+      } data;
+    /* Indirect block that points to the blocks last looked up through
+     * the block map, so that sequential access walks down to each
+     * indirect block only once. Protected by MUTEX. */
+    size_t leaf_first;                  /* First block it points to. */
+    disk_sector_t leaf_sector;          /* Its sector, 0 if none. */
+    /* Where to look for the next sectors to allocate: just past those
+     * allocated last, or past the inode itself at first, so that the
+     * blocks of a file end up near each other. Protected by MUTEX. */
+    disk_sector_t alloc_goal;
   };
 
-/* Set the length of INODE_ to LENGTH. */
+/* Byte range of an inode locked for the duration of a read or a write,
+ * so that operations on disjoint ranges of a file proceed in parallel
+ * while overlapping ones do not interleave. Readers share ranges and
+ * writers lock them exclusively. Lives on the stack of its holder. */
+struct range_lock
+  {
+    struct list_elem elem;              /* Element in inode's ranges. */
+    off_t start;                        /* First byte. */
+    off_t end;                          /* Byte past the last one. */
+    bool exclusive;                     /* Held by a writer. */
+  };
+
+/* Returns true if ranges A and B cannot be held at the same time. */
 static bool
-inode_set_length (const struct inode * inode_, off_t length)
+range_conflicts (const struct range_lock * a, const struct range_lock * b)
 {
-  disk_sector_t inode = inode_->sector;
-  off_t offset;
-  if (inode == FREE_MAP_SECTOR)
-    offset = sizeof (disk_sector_t);
-  else
-    offset = sizeof (uint32_t);
-  return buffer_cache_write (inode, offset, sizeof (&length), &length, false);
+  return (a->exclusive || b->exclusive)
+         && a->start < b->end && b->start < a->end;
+}
+
+/* Locks the bytes of INODE from START up to but not including END into
+ * RANGE, waiting for overlapping ranges that conflict with it to be
+ * unlocked. A writer whose range runs past the end of file extends the
+ * file, so it locks everything up to RANGE_EOF instead: extending is
+ * the only thing that keeps everyone off the tail of the file. */
+static void
+range_acquire (struct inode * inode, struct range_lock * range,
+               off_t start, off_t end, bool exclusive)
+{
+  struct list_elem * e;
+  range->start = start;
+  range->exclusive = exclusive;
+  inode_lock (inode);
+ retry:
+  range->end = exclusive && end > inode_length (inode) ? RANGE_EOF : end;
+  for (e = list_begin (&inode->ranges); e != list_end (&inode->ranges);
+       e = list_next (e))
+    if (range_conflicts (range,
+                         list_entry (e, struct range_lock, elem)))
+    {
+      cond_wait (&inode->range_released, &inode->mutex);
+      goto retry;
+    }
+  list_push_back (&inode->ranges, &range->elem);
+  inode_unlock (inode);
+}
+
+/* Unlocks RANGE of INODE. */
+static void
+range_release (struct inode * inode, struct range_lock * range)
+{
+  inode_lock (inode);
+  list_remove (&range->elem);
+  cond_broadcast (&inode->range_released, &inode->mutex);
+  inode_unlock (inode);
+}
+
+/* Writes the SIZE bytes of INODE's copy of its on-disk inode starting
+ * at FIELD back to the buffer cache. */
+static bool
+inode_write_back (struct inode * inode, const void * field, size_t size)
+{
+  off_t offset = (const uint8_t *) field - (const uint8_t *) &inode->data;
+  ASSERT (offset >= 0 && offset + size <= DISK_SECTOR_SIZE);
+  return buffer_cache_write (inode->sector, offset, size, field, false);
+}
+
+/* Returns a pointer to the length in INODE's copy of its on-disk
+ * inode. */
+static off_t *
+inode_length_field (struct inode * inode)
+{
+  if (inode->sector == FREE_MAP_SECTOR)
+    return &inode->data.disk_0.length;
+  return &inode->data.disk.length;
 }
 
 /* Returns the type of inode. Possible values are given as enum inode_type. */
 uint32_t
 inode_get_type (const struct inode * inode)
 {
-  uint32_t type;
-  if (!buffer_cache_read (inode->sector, END_OF_FILE, 0, sizeof (type), &type))
-    return TYPE_ERROR;
-  return type;
+  if (inode->sector == FREE_MAP_SECTOR)
+    return TYPE_FILE;
+  return inode->data.disk.type;
 }
 
 static void
-inode_set_type (const struct inode * inode, uint32_t type)
+inode_set_type (struct inode * inode, uint32_t type)
 {
-  buffer_cache_write (inode->sector, 0, sizeof (type), &type, false);
+  inode->data.disk.type = type;
+  inode_write_back (inode, &inode->data.disk.type, sizeof type);
+}
+
+/* Allocates CNT consecutive sectors for INODE as close to its previous
+ * ones as possible and stores the first into *SECTORP. Returns false if
+ * there is no such run of free sectors. */
+static bool
+inode_allocate_sectors (struct inode * inode, size_t cnt,
+                        disk_sector_t * sectorp)
+{
+  if (!free_map_allocate_near (cnt, inode->alloc_goal, sectorp))
+    return false;
+  inode->alloc_goal = *sectorp + cnt;
+  return true;
 }
 
 /* Reads the sector value pointed by POS of SECTOR. When ALLOC is true,
- * allocate a free block and write it to POS if the corresponding block
+ * allocate a free block for INODE and write it to POS if the block
  * is not yet allocated. If not, just returns 0 when there is no corres-
  * ponding block. Returns the sector value when succeeded. Otherwise
  * return -1. */
 static disk_sector_t
-read_sector (disk_sector_t sector, off_t pos, bool alloc)
+read_sector (struct inode * inode, disk_sector_t sector, off_t pos,
+             bool alloc)
 {
-  disk_sector_t result;
-  if (!buffer_cache_read (sector, END_OF_FILE, pos, sizeof (result), &result))
+  const disk_sector_t * pointers = buffer_cache_pin (sector);
+  if (pointers == NULL)
     return -1;
+  disk_sector_t result = pointers[pos / sizeof (disk_sector_t)];
+  buffer_cache_unpin (pointers);
   if (result > 0) return result;
   /* Sector not yet allocated. */
   if (!alloc) return 0;
-  if (!free_map_allocate (1, &result)) return -1;
+  if (!inode_allocate_sectors (inode, 1, &result)) return -1;
   if (!buffer_cache_write (sector, pos, sizeof (result), &result, false))
     return -1;
   if (!buffer_cache_write (result, 0, 0, NULL, true))     /* Zero out. */
@@ -108,80 +266,791 @@ read_sector (disk_sector_t sector, off_t pos, bool alloc)
   return result;
 }
 
+/* Same as read_sector, but for the pointer *POINTER within INODE's copy
+ * of its on-disk inode. */
+static disk_sector_t
+read_inode_pointer (struct inode * inode, disk_sector_t * pointer,
+                    bool alloc)
+{
+  disk_sector_t result = *pointer;
+  if (result > 0) return result;
+  /* Sector not yet allocated. */
+  if (!alloc) return 0;
+  if (!inode_allocate_sectors (inode, 1, &result)) return -1;
+  if (!buffer_cache_write (result, 0, 0, NULL, true))     /* Zero out. */
+    return -1;
+  *pointer = result;
+  if (!inode_write_back (inode, pointer, sizeof *pointer))
+    return -1;
+  return result;
+}
+
+/* Returns the sector that holds block INDEX of INODE, which maps blocks
+ * by pointers. ALLOC and the return value are as in byte_to_sector. If
+ * INSTALL is not 0, block INDEX is made to point to sector INSTALL
+ * instead, allocating indirect blocks on the way, and INSTALL is
+ * returned. */
+static disk_sector_t
+block_map_sector (struct inode * inode, size_t index, bool alloc,
+                  disk_sector_t install)
+{
+  ASSERT (install == 0 || alloc);
+  struct block_map * map = &inode->data.disk.map.blocks;
+  /* Sector of the indirect block that points to the block. */
+  disk_sector_t sector;
+  if (index < DIRECT_BLOCKS)              /* in direct block range */
+  {
+    disk_sector_t * pointer = &map->direct[index];
+    if (install == 0)
+      return read_inode_pointer (inode, pointer, alloc);
+    *pointer = install;
+    if (!inode_write_back (inode, pointer, sizeof *pointer))
+      return -1;
+    return install;
+  }
+  index -= DIRECT_BLOCKS;
+  /* index of the sector inside the indirect block. */
+  size_t subindex = index % INDIRECT_POINTERS;
+  /* First block the indirect block points to. */
+  size_t first = DIRECT_BLOCKS + index - subindex;
+  /* On which indirect block does the pointer to the desired block
+   * resides. */
+  index /= INDIRECT_POINTERS;
+  if (inode->leaf_sector != 0 && inode->leaf_first == first)
+    sector = inode->leaf_sector;
+  else if (index < SINGLY_INDIRECT_BLOCKS) /* in singly-indirect block range */
+  {
+    /* Pointer to the corresponding singly-indirect block. */
+    sector = read_inode_pointer (inode, &map->singly[index], alloc);
+    if ((int)sector < 1) return sector;
+  }
+  else                                    /* In doubly-indirect block. */
+  {
+    index -= SINGLY_INDIRECT_BLOCKS;
+    /* File too large to be handled by file system. */
+    if (index >= INDIRECT_POINTERS) return alloc ? -1 : 0;
+    /* Pointer to the doubly-indirect block. */
+    sector = read_inode_pointer (inode, &map->doubly, alloc);
+    if ((int)sector < 1) return sector;   /* Read Sector Error */
+    /* Pointer to the corresponding singly-indirect block. */
+    sector = read_sector (inode, sector, index * sizeof (disk_sector_t),
+                          alloc);
+    if ((int)sector < 1) return sector;   /* Read Sector Error */
+  }
+  inode->leaf_first = first;
+  inode->leaf_sector = sector;
+  off_t offset = subindex * sizeof (disk_sector_t);
+  if (install == 0)
+    return read_sector (inode, sector, offset, alloc);
+  if (!buffer_cache_write (sector, offset, sizeof (install), &install, false))
+    return -1;
+  return install;
+}
+
+/* Returns the index in MAP of the first extent that starts after block
+ * INDEX. The extent before it, if any, is the only one that may contain
+ * INDEX. */
+static size_t
+extent_search (const struct extent_map * map, size_t index)
+{
+  size_t lo = 0, hi = map->cnt;
+  while (lo < hi)
+  {
+    size_t mid = (lo + hi) / 2;
+    if (map->extents[mid].block <= index)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return lo;
+}
+
+/* Returns the sector that holds block INDEX according to MAP, or 0 if
+ * the block is not allocated. */
+static disk_sector_t
+extent_lookup (const struct extent_map * map, size_t index)
+{
+  size_t i = extent_search (map, index);
+  if (i == 0)
+    return 0;
+  const struct extent * e = &map->extents[i - 1];
+  if (index >= e->block + e->length)
+    return 0;
+  return e->start + (index - e->block);
+}
+
+/* Merges extent I of MAP with the extent after it if the second one
+ * continues the first both in the file and on disk. */
+static void
+extent_merge_next (struct extent_map * map, size_t i)
+{
+  struct extent * e = &map->extents[i];
+  if (i + 1 < map->cnt && e->block + e->length == e[1].block
+      && e->start + e->length == e[1].start)
+  {
+    e->length += e[1].length;
+    memmove (&map->extents[i + 1], &map->extents[i + 2],
+             (map->cnt - i - 2) * sizeof *map->extents);
+    --map->cnt;
+  }
+}
+
+/* Allocates a zeroed indirect block for INODE into *SECTORP unless it
+ * already has one. Returns false on failure, leaving *SECTORP 0. */
+static bool
+indirect_block_new (struct inode * inode, disk_sector_t * sectorp)
+{
+  disk_sector_t sector;
+  if (*sectorp != 0)
+    return true;
+  if (!inode_allocate_sectors (inode, 1, &sector))
+    return false;
+  *sectorp = sector;
+  return buffer_cache_write (sector, 0, 0, NULL, true);     /* Zero out. */
+}
+
+/* Frees indirect block SECTOR, if any, that was allocated for a block
+ * map that never got installed. */
+static void
+indirect_block_discard (disk_sector_t sector)
+{
+  if (sector == 0)
+    return;
+  buffer_cache_remove_range (sector, 1);
+  free_map_release (sector, 1);
+}
+
+/* Rewrites INODE, which maps blocks by extents, to map blocks by
+ * pointers instead. The block map and its indirect blocks are built
+ * aside and installed only once all of them are written, so on failure
+ * INODE still maps its blocks by extents and nothing leaks. Returns
+ * false if a block lies beyond what a block map can point to or if an
+ * indirect block cannot be allocated. */
+static bool
+extents_to_blocks (struct inode * inode)
+{
+  const struct extent_map * extents = &inode->data.disk.map.extents;
+  struct block_map * map;
+  /* Pointers the doubly-indirect block holds. */
+  disk_sector_t * doubly;
+  bool success = true;
+  size_t i, j;
+  if (extents->cnt > 0)
+  {
+    const struct extent * last = &extents->extents[extents->cnt - 1];
+    if (last->block + last->length > BLOCK_MAP_BLOCKS)
+      return false;
+  }
+  map = calloc (1, sizeof *map);
+  doubly = calloc (INDIRECT_POINTERS, sizeof *doubly);
+  if (map == NULL || doubly == NULL)
+  {
+    free (map);
+    free (doubly);
+    return false;
+  }
+  for (i = 0; success && i < extents->cnt; ++i)
+  {
+    const struct extent * e = &extents->extents[i];
+    for (j = 0; success && j < e->length; ++j)
+    {
+      size_t index = e->block + j;
+      disk_sector_t sector = e->start + j;
+      disk_sector_t * indirect;
+      if (index < DIRECT_BLOCKS)
+      {
+        map->direct[index] = sector;
+        continue;
+      }
+      index -= DIRECT_BLOCKS;
+      if (index < SINGLY_INDIRECT_BLOCKS * INDIRECT_POINTERS)
+        indirect = &map->singly[index / INDIRECT_POINTERS];
+      else
+      {
+        if (!indirect_block_new (inode, &map->doubly))
+        {
+          success = false;
+          break;
+        }
+        indirect = &doubly[index / INDIRECT_POINTERS
+                           - SINGLY_INDIRECT_BLOCKS];
+      }
+      success = indirect_block_new (inode, indirect)
+                && buffer_cache_write (*indirect,
+                                       index % INDIRECT_POINTERS
+                                       * sizeof sector,
+                                       sizeof sector, &sector, false);
+    }
+  }
+  if (success && map->doubly != 0)
+    success = buffer_cache_write (map->doubly, 0, DISK_SECTOR_SIZE, doubly,
+                                  false);
+  if (success)
+  {
+    inode->data.disk.map.blocks = *map;
+    inode->data.disk.magic = INODE_MAGIC;
+    inode->leaf_sector = 0;
+    success = inode_write_back (inode, &inode->data.disk,
+                                sizeof inode->data.disk);
+  }
+  else
+  {
+    /* Roll back. */
+    for (i = 0; i < SINGLY_INDIRECT_BLOCKS; ++i)
+      indirect_block_discard (map->singly[i]);
+    for (i = 0; i < INDIRECT_POINTERS; ++i)
+      indirect_block_discard (doubly[i]);
+    indirect_block_discard (map->doubly);
+  }
+  free (doubly);
+  free (map);
+  return success;
+}
+
+/* Allocates a sector for block INDEX of INODE, which maps blocks by
+ * extents, and zeroes it. The sector right after the extent that ends
+ * at INDEX is taken if it is free, so a file written in order stays in
+ * a single extent. When a new extent is needed and the inode has no
+ * room for it, the file falls back to mapping blocks by pointers.
+ * Returns the sector, or -1 on failure. */
+static disk_sector_t
+extent_allocate (struct inode * inode, size_t index)
+{
+  struct extent_map * map = &inode->data.disk.map.extents;
+  size_t i = extent_search (map, index);
+  struct extent * prev = i > 0 ? &map->extents[i - 1] : NULL;
+  disk_sector_t result;
+  if (prev != NULL && prev->block + prev->length == index
+      && free_map_allocate_at (prev->start + prev->length, 1))
+  {
+    result = prev->start + prev->length++;
+    /* The extent may now run into the next one. */
+    extent_merge_next (map, i - 1);
+  }
+  else
+  {
+    if (!inode_allocate_sectors (inode, 1, &result))
+      return -1;
+    if (map->cnt == INODE_EXTENTS)
+    {
+      /* Too fragmented. */
+      if (!extents_to_blocks (inode)
+          || (int)block_map_sector (inode, index, true, result) == -1)
+      {
+        free_map_release (result, 1);
+        return -1;
+      }
+      if (!buffer_cache_write (result, 0, 0, NULL, true))   /* Zero out. */
+        return -1;
+      return result;
+    }
+    memmove (&map->extents[i + 1], &map->extents[i],
+             (map->cnt - i) * sizeof *map->extents);
+    map->extents[i].block = index;
+    map->extents[i].start = result;
+    map->extents[i].length = 1;
+    ++map->cnt;
+  }
+  if (!inode_write_back (inode, map, sizeof *map))
+    return -1;
+  if (!buffer_cache_write (result, 0, 0, NULL, true))       /* Zero out. */
+    return -1;
+  return result;
+}
+
+/* Largest number of runs of sectors one call to blocks_reserve
+ * allocates. */
+#define RESERVE_RUNS 8
+
+/* Runs of sectors blocks_reserve allocated. They hold whatever the disk
+ * held before, so the caller zeroes those it does not overwrite, once
+ * it has unlocked the inode but before it unlocks their byte range. */
+struct reservation
+  {
+    size_t cnt;                         /* Number of runs. */
+    struct extent runs[RESERVE_RUNS];
+  };
+
+/* Allocates sectors for the unallocated blocks of INODE, which maps
+ * blocks by extents, from block FIRST up to but not including block
+ * END, and records them into RES. Each gap between extents is filled
+ * with as few runs of consecutive sectors as the free map allows,
+ * continuing the extent before the gap when the sectors after it are
+ * free. Stops early when RES is full, in which case the caller may call
+ * again for the rest, or when the inode has no room for another extent,
+ * leaving the remaining blocks to be allocated one at a time when
+ * written. Returns false if the disk is full. */
+static bool
+extent_reserve (struct inode * inode, size_t first, size_t end,
+                struct reservation * res)
+{
+  struct extent_map * map = &inode->data.disk.map.extents;
+  bool success = true;
+  bool changed = false;
+  size_t block = first;
+  res->cnt = 0;
+  while (block < end && res->cnt < RESERVE_RUNS)
+  {
+    size_t i = extent_search (map, block);
+    struct extent * prev = i > 0 ? &map->extents[i - 1] : NULL;
+    if (prev != NULL && block < prev->block + prev->length)
+    {
+      /* Already allocated. */
+      block = prev->block + prev->length;
+      continue;
+    }
+    /* The gap ends at the next extent. */
+    size_t cnt = end - block;
+    if (i < map->cnt && map->extents[i].block < end)
+      cnt = map->extents[i].block - block;
+    disk_sector_t start;
+    if (prev != NULL && prev->block + prev->length == block
+        && free_map_allocate_at (prev->start + prev->length, cnt))
+    {
+      start = prev->start + prev->length;
+      prev->length += cnt;
+      extent_merge_next (map, i - 1);
+    }
+    else
+    {
+      if (map->cnt == INODE_EXTENTS)
+        break;
+      while (!inode_allocate_sectors (inode, cnt, &start))
+        if ((cnt /= 2) == 0)
+          break;
+      if (cnt == 0)
+      {
+        success = false;
+        break;
+      }
+      memmove (&map->extents[i + 1], &map->extents[i],
+               (map->cnt - i) * sizeof *map->extents);
+      map->extents[i].block = block;
+      map->extents[i].start = start;
+      map->extents[i].length = cnt;
+      ++map->cnt;
+      extent_merge_next (map, i);
+    }
+    changed = true;
+    res->runs[res->cnt].block = block;
+    res->runs[res->cnt].start = start;
+    res->runs[res->cnt].length = cnt;
+    ++res->cnt;
+    block += cnt;
+  }
+  if (changed && !inode_write_back (inode, map, sizeof *map))
+    success = false;
+  return success;
+}
+
+/* Same as extent_reserve, but for INODE, which maps blocks by
+ * pointers: each run of unallocated blocks gets as few runs of
+ * consecutive sectors as the free map allows, and the pointers to them
+ * are installed one by one, with the indirect blocks they need. Blocks
+ * past the largest file the block map holds are left alone. */
+static bool
+block_map_reserve (struct inode * inode, size_t first, size_t end,
+                   struct reservation * res)
+{
+  size_t block = first;
+  res->cnt = 0;
+  if (end > BLOCK_MAP_BLOCKS)
+    end = BLOCK_MAP_BLOCKS;
+  while (block < end && res->cnt < RESERVE_RUNS)
+  {
+    disk_sector_t sector = block_map_sector (inode, block, false, 0);
+    if ((int)sector == -1)
+      return false;
+    if (sector > 0)
+    {
+      /* Already allocated. */
+      ++block;
+      continue;
+    }
+    /* The gap ends at the next allocated block. */
+    size_t cnt = 1;
+    while (block + cnt < end
+           && block_map_sector (inode, block + cnt, false, 0) == 0)
+      ++cnt;
+    disk_sector_t start;
+    while (!inode_allocate_sectors (inode, cnt, &start))
+      if ((cnt /= 2) == 0)
+        return false;
+    size_t i;
+    for (i = 0; i < cnt; ++i)
+      if ((int)block_map_sector (inode, block + i, true, start + i) == -1)
+        break;
+    if (i < cnt)
+      free_map_release (start + i, cnt - i);
+    if (i > 0)
+    {
+      res->runs[res->cnt].block = block;
+      res->runs[res->cnt].start = start;
+      res->runs[res->cnt].length = i;
+      ++res->cnt;
+    }
+    if (i < cnt)
+      return false;
+    block += cnt;
+  }
+  return true;
+}
+
+/* Allocates sectors for the unallocated blocks of INODE from block
+ * FIRST up to but not including block END into RES, with extent_reserve
+ * or block_map_reserve depending on how INODE maps blocks. Data inside
+ * the inode needs none. */
+static bool
+blocks_reserve (struct inode * inode, size_t first, size_t end,
+                struct reservation * res)
+{
+  res->cnt = 0;
+  if (inode->data.disk.magic == EXTENT_MAGIC)
+    return extent_reserve (inode, first, end, res);
+  if (inode->data.disk.magic == INODE_MAGIC)
+    return block_map_reserve (inode, first, end, res);
+  return true;
+}
+
+/* Zeroes the sectors recorded in RES that hold blocks FIRST up to but
+ * not including END. Returns false if the cache fails. */
+static bool
+reservation_zero (const struct reservation * res, size_t first, size_t end)
+{
+  bool success = true;
+  size_t i, block;
+  for (i = 0; i < res->cnt; ++i)
+  {
+    const struct extent * run = &res->runs[i];
+    for (block = run->block; block < run->block + run->length; ++block)
+      if (block >= first && block < end
+          && !buffer_cache_write (run->start + (block - run->block), 0, 0,
+                                  NULL, true))       /* Zero out. */
+        success = false;
+  }
+  return success;
+}
+
+/* Allocates and zeroes sectors for the unallocated blocks of INODE from
+ * block FIRST up to but not including block END, as blocks_reserve
+ * does. The sectors are zeroed with INODE unlocked, so the caller must
+ * hold the byte range of the blocks exclusively. Returns false if the
+ * disk is full. */
+static bool
+blocks_reserve_zeroed (struct inode * inode, size_t first, size_t end)
+{
+  struct reservation res;
+  bool success = true;
+  ASSERT (lock_held_by_current_thread (&inode->mutex));
+  while (success)
+  {
+    success = blocks_reserve (inode, first, end, &res);
+    inode_unlock (inode);
+    if (!reservation_zero (&res, first, end))
+      success = false;
+    inode_lock (inode);
+    if (res.cnt < RESERVE_RUNS)
+      break;
+  }
+  return success;
+}
+
+/* Moves the data of INODE, which holds its data itself, to a sector of
+ * its own and makes it map blocks by extents. Files that outgrow their
+ * inode are converted so, and never go back. Returns false if the disk
+ * is full, leaving INODE as it was. */
+static bool
+inline_to_extents (struct inode * inode)
+{
+  struct inode_disk * disk_inode = &inode->data.disk;
+  struct extent_map * map = &disk_inode->map.extents;
+  disk_sector_t sector = 0;
+  if (disk_inode->length > 0)
+  {
+    if (!inode_allocate_sectors (inode, 1, &sector))
+      return false;
+    /* The rest of the sector is zeroed. */
+    if (!buffer_cache_write (sector, 0, disk_inode->length,
+                             disk_inode->map.data, true))
+    {
+      free_map_release (sector, 1);
+      return false;
+    }
+  }
+  memset (&disk_inode->map, 0, sizeof disk_inode->map);
+  if (sector > 0)
+  {
+    map->cnt = 1;
+    map->extents[0].block = 0;
+    map->extents[0].start = sector;
+    map->extents[0].length = 1;
+  }
+  disk_inode->magic = EXTENT_MAGIC;
+  return inode_write_back (inode, disk_inode, sizeof *disk_inode);
+}
+
 /* Returns the disk sector that contains byte offset POS within
  * INODE. If ALLOC is set to true, it allocates a sector if the sector
  * is not yet allocated. Otherwise it returns 0 if the corresponding
- * sector is not yet allocated. Returns -1 when error occurs.*/
+ * sector is not yet allocated. Returns -1 when error occurs. INODE's
+ * mutex must be held. */
 static disk_sector_t
-byte_to_sector (disk_sector_t inode, off_t pos, bool alloc) 
+byte_to_sector (struct inode * inode, off_t pos, bool alloc) 
 {
+  ASSERT (lock_held_by_current_thread (&inode->mutex));
   /* Need to handle FREE_MAP_SECTOR in a special way. */
-  if (inode == FREE_MAP_SECTOR)
+  if (inode->sector == FREE_MAP_SECTOR)
   {
-    struct inode_disk_0 inode_disk;
-    if (buffer_cache_read (FREE_MAP_SECTOR, END_OF_FILE, 0,
-                            sizeof (inode_disk), &inode_disk))
-    {
-      if (pos < inode_disk.length)
-        return inode_disk.start + pos / DISK_SECTOR_SIZE;
-      if (!alloc) return 0;
-    }
-    return -1;
+    const struct inode_disk_0 * disk_inode = &inode->data.disk_0;
+    if (pos < disk_inode->length)
+      return disk_inode->start + pos / DISK_SECTOR_SIZE;
+    return alloc ? (disk_sector_t) -1 : 0;
+  }
+  /* Data inside the inode has no sector. Only writers ask for one, and
+   * they get it by moving the data out. */
+  if (inode->data.disk.magic == INLINE_MAGIC)
+  {
+    ASSERT (alloc);
+    if (!inline_to_extents (inode))
+      return -1;
   }
-  /* Number of pointers to sectors a disk can hold. */
-  const size_t num_sectors = DISK_SECTOR_SIZE / sizeof (disk_sector_t);
   /* POS is in INDEX-th sector of the file. */
   size_t index = pos / DISK_SECTOR_SIZE;
-  /* first field is type, second field is inode->length */
-  off_t offset = sizeof (uint32_t) + sizeof (size_t);
-  if (index < DIRECT_BLOCKS)              /* in direct block range */
+  if (inode->data.disk.magic != EXTENT_MAGIC)
+    return block_map_sector (inode, index, alloc, 0);
+  disk_sector_t result = extent_lookup (&inode->data.disk.map.extents, index);
+  if (result > 0 || !alloc)
+    return result;
+  return extent_allocate (inode, index);
+}
+
+/* Run of consecutive sectors waiting to be freed. */
+struct free_run
   {
-    offset += sizeof (disk_sector_t) * index;
-    return read_sector (inode, offset, alloc);
+    disk_sector_t start;                /* First sector. */
+    size_t cnt;                         /* Number of sectors. */
+  };
+
+/* Drops the sectors of RUN from the buffer cache and releases them in
+ * the free map. */
+static void
+free_run_flush (struct free_run * run)
+{
+  if (run->cnt == 0)
+    return;
+  /* Dropped first, so that the sectors are not found in the cache once
+   * they are allocated again. */
+  buffer_cache_remove_range (run->start, run->cnt);
+  free_map_release (run->start, run->cnt);
+  run->cnt = 0;
+}
+
+/* Adds the CNT sectors starting at START to RUN, flushing RUN first if
+ * they do not continue it. */
+static void
+free_run_add (struct free_run * run, disk_sector_t start, size_t cnt)
+{
+  if (run->cnt > 0 && run->start + run->cnt == start)
+  {
+    run->cnt += cnt;
+    return;
   }
-  index -= DIRECT_BLOCKS;
-  offset += DIRECT_BLOCKS * sizeof (disk_sector_t);
-  /* index of the sector inside the indirect block. */
-  size_t subindex = index % num_sectors;
-  /* On which indirect block does the pointer to the desired block
-   * resides. */
-  index /= num_sectors;
-  if (index < SINGLY_INDIRECT_BLOCKS)     /* in singly-indirect block range */
+  free_run_flush (run);
+  run->start = start;
+  run->cnt = cnt;
+}
+
+/* Adds every sector the indirect block at SECTOR points to, and the
+ * block itself, to RUN. DEPTH is 1 for a singly-indirect block and 2
+ * for a doubly-indirect block. If the block cannot be read, it and the
+ * blocks below it are leaked rather than freed. */
+static void
+free_indirect (struct free_run * run, disk_sector_t sector, int depth)
+{
+  disk_sector_t * pointers = malloc (DISK_SECTOR_SIZE);
+  size_t i;
+  if (pointers == NULL
+      || !buffer_cache_read (sector, 0, DISK_SECTOR_SIZE, pointers))
   {
-    offset += index * sizeof (disk_sector_t);
-    /* Pointer to the corresponding singly-indirect block. */
-    disk_sector_t pointer = read_sector (inode, offset, alloc);
-    if (pointer < 1) return pointer;
-    offset = subindex * sizeof (disk_sector_t);
-    return read_sector (pointer, offset, alloc);
-  }
-  /* In doubly-indirect block. */
-  index -= SINGLY_INDIRECT_BLOCKS;
-  offset += SINGLY_INDIRECT_BLOCKS * sizeof (disk_sector_t);
-  /* File too large to be handled by file system. */
-  if (index >= num_sectors) return alloc ? -1 : 0;
-  /* Pointer to the doubly-indirect block. */
-  disk_sector_t pointer = read_sector (inode, offset, alloc);
-  if (pointer < 1) return pointer;      /* Read Sector Error */
-  offset = index * sizeof (disk_sector_t);
-  /* Pointer to the corresponding singly-indirect block. */
-  pointer = read_sector (pointer, offset, alloc);
-  if (pointer < 1) return pointer;      /* Read Sector Error */
-  offset = subindex * sizeof (disk_sector_t);
-  return read_sector (pointer, offset, alloc);
-}
-
-/* List of open inodes, so that opening a single inode twice
-   returns the same `struct inode'. */
-static struct list open_inodes;
-/* Lock that should be acquired before accessing OPEN_INODES. */
+    free (pointers);
+    return;
+  }
+  for (i = 0; i < INDIRECT_POINTERS; ++i)
+    if (pointers[i] > 0)
+    {
+      if (depth > 1)
+        free_indirect (run, pointers[i], depth - 1);
+      else
+        free_run_add (run, pointers[i], 1);
+    }
+  free (pointers);
+  free_run_add (run, sector, 1);
+}
+
+/* Frees the blocks from block FIRST on among those the indirect block
+ * at SECTOR points to, and clears their pointers. The block maps the
+ * blocks of the file starting at block BASE, and DEPTH is as in
+ * free_indirect. FIRST must be greater than BASE, so that the block
+ * itself is kept. */
+static void
+truncate_indirect (struct free_run * run, disk_sector_t sector, int depth,
+                   size_t base, size_t first)
+{
+  /* Number of blocks each pointer maps. */
+  size_t span = depth > 1 ? INDIRECT_POINTERS : 1;
+  disk_sector_t * pointers = malloc (DISK_SECTOR_SIZE);
+  bool changed = false;
+  size_t i;
+  ASSERT (first > base);
+  if (pointers == NULL
+      || !buffer_cache_read (sector, 0, DISK_SECTOR_SIZE, pointers))
+  {
+    free (pointers);
+    return;
+  }
+  for (i = 0; i < INDIRECT_POINTERS; ++i)
+  {
+    size_t block = base + i * span;
+    if (pointers[i] == 0 || block + span <= first)
+      continue;
+    if (block < first)
+      truncate_indirect (run, pointers[i], depth - 1, block, first);
+    else
+    {
+      if (depth > 1)
+        free_indirect (run, pointers[i], depth - 1);
+      else
+        free_run_add (run, pointers[i], 1);
+      pointers[i] = 0;
+      changed = true;
+    }
+  }
+  if (changed)
+    buffer_cache_write (sector, 0, DISK_SECTOR_SIZE, pointers, false);
+  free (pointers);
+}
+
+/* Frees the blocks of INODE from block FIRST on into RUN and removes
+ * them from its map. */
+static void
+inode_free_tail (struct inode * inode, struct free_run * run, size_t first)
+{
+  size_t i;
+  if (inode->data.disk.magic == INLINE_MAGIC)
+    return;
+  if (inode->data.disk.magic == EXTENT_MAGIC)
+  {
+    struct extent_map * map = &inode->data.disk.map.extents;
+    size_t cnt = extent_search (map, first);
+    if (cnt > 0)
+    {
+      /* The last extent kept may run past FIRST. */
+      struct extent * e = &map->extents[cnt - 1];
+      if (e->block + e->length > first)
+      {
+        free_run_add (run, e->start + (first - e->block),
+                      e->block + e->length - first);
+        e->length = first - e->block;
+        if (e->length == 0)
+          --cnt;
+      }
+    }
+    for (i = cnt; i < map->cnt; ++i)
+      free_run_add (run, map->extents[i].start, map->extents[i].length);
+    map->cnt = cnt;
+  }
+  else
+  {
+    struct block_map * map = &inode->data.disk.map.blocks;
+    /* First block each singly-indirect block and the doubly-indirect
+     * block map. */
+    size_t base = DIRECT_BLOCKS;
+    for (i = first; i < DIRECT_BLOCKS; ++i)
+      if (map->direct[i] > 0)
+      {
+        free_run_add (run, map->direct[i], 1);
+        map->direct[i] = 0;
+      }
+    for (i = 0; i <= SINGLY_INDIRECT_BLOCKS; ++i)
+    {
+      bool doubly = i == SINGLY_INDIRECT_BLOCKS;
+      disk_sector_t * pointer = doubly ? &map->doubly : &map->singly[i];
+      int depth = doubly ? 2 : 1;
+      size_t span = doubly ? INDIRECT_POINTERS * INDIRECT_POINTERS
+                           : INDIRECT_POINTERS;
+      if (*pointer > 0 && base + span > first)
+      {
+        if (base >= first)
+        {
+          free_indirect (run, *pointer, depth);
+          *pointer = 0;
+        }
+        else
+          truncate_indirect (run, *pointer, depth, base, first);
+      }
+      base += span;
+    }
+    /* Indirect blocks may have been freed. */
+    inode->leaf_sector = 0;
+  }
+}
+
+/* Frees every sector of removed INODE: its data, its indirect blocks
+ * and the inode itself, including blocks reserved past its end. The
+ * block map is walked once, and sectors are freed in runs of
+ * consecutive sectors. */
+static void
+inode_deallocate (struct inode * inode)
+{
+  struct free_run run = {0, 0};
+  inode_free_tail (inode, &run, 0);
+  free_run_add (&run, inode->sector, 1);
+  free_run_flush (&run);
+}
+
+/* Open inodes hashed by sector number, so that opening a single inode
+   twice returns the same `struct inode'. */
+static struct hash open_inodes;
+/* Lock that should be acquired before accessing OPEN_INODES or the
+   open counts of the inodes in it. Held only for the lookup, never
+   across disk I/O. */
 static struct lock open_inodes_lock;
 
+/* Hash function for OPEN_INODES. */
+static unsigned
+open_inodes_hash (const struct hash_elem * elem, void * aux UNUSED)
+{
+  return hash_int (hash_entry (elem, struct open_key, elem)->sector);
+}
+
+/* Comparison function for OPEN_INODES. */
+static bool
+open_inodes_less (const struct hash_elem * a, const struct hash_elem * b,
+                  void * aux UNUSED)
+{
+  return hash_entry (a, struct open_key, elem)->sector
+         < hash_entry (b, struct open_key, elem)->sector;
+}
+
+/* Returns the inode in OPEN_INODES whose sector is SECTOR, or a null
+   pointer if there is none. OPEN_INODES_LOCK must be held. */
+static struct inode *
+open_inodes_find (disk_sector_t sector)
+{
+  struct open_key key;
+  struct hash_elem * elem;
+  ASSERT (lock_held_by_current_thread (&open_inodes_lock));
+  key.sector = sector;
+  elem = hash_find (&open_inodes, &key.elem);
+  return elem != NULL ? hash_entry (elem, struct inode, key.elem) : NULL;
+}
+
 /* Initializes the inode module. */
 void
 inode_init (void) 
 {
-  list_init (&open_inodes);
+  if (!hash_init (&open_inodes, open_inodes_hash, open_inodes_less, NULL))
+    PANIC ("cannot allocate open inode table");
   lock_init (&open_inodes_lock);
 }
 
@@ -230,7 +1099,9 @@ inode_create (disk_sector_t sector, off_t length, uint32_t type)
     {
       disk_inode->length = length;
       disk_inode->type = type;
-      disk_inode->magic = INODE_MAGIC;
+      /* Small files start out inside the inode. */
+      disk_inode->magic = length <= (off_t) INLINE_MAX ? INLINE_MAGIC
+                                                      : EXTENT_MAGIC;
       if (buffer_cache_write (sector, 0, DISK_SECTOR_SIZE, disk_inode, false))
         success = true;
       /* Other contents are lazily loaded. */
@@ -241,45 +1112,66 @@ inode_create (disk_sector_t sector, off_t length, uint32_t type)
 
 /* Reads an inode from SECTOR
    and returns a `struct inode' that contains it.
-   Returns a null pointer if memory allocation fails. */
+   Returns a null pointer if memory allocation fails or if the
+   inode is open but has been removed. */
 struct inode *
 inode_open (disk_sector_t sector) 
 {
-  struct list_elem *e;
   struct inode *inode;
+  struct inode *other;
 
-  lock_acquire (&open_inodes_lock);
   /* Check whether this inode is already open. */
-  for (e = list_begin (&open_inodes); e != list_end (&open_inodes);
-       e = list_next (e)) 
+  lock_acquire (&open_inodes_lock);
+  inode = open_inodes_find (sector);
+  if (inode != NULL)
     {
-      inode = list_entry (e, struct inode, elem);
-      if (inode->sector == sector) 
-        {
-          inode_lock (inode);
-          lock_release (&open_inodes_lock);
-          inode_reopen (inode);
-          inode_unlock (inode);
-          return inode; 
-        }
+      if (inode->removed)
+        inode = NULL;
+      else
+        inode->open_cnt++;
+      lock_release (&open_inodes_lock);
+      return inode;
     }
+  lock_release (&open_inodes_lock);
 
-  /* Allocate memory. */
+  /* Allocate memory and read the inode without holding the lock, so
+     that opens of other inodes go on meanwhile. */
   inode = malloc (sizeof *inode);
   if (inode == NULL)
+    return NULL;
+  if (!buffer_cache_read (sector, 0, DISK_SECTOR_SIZE, &inode->data))
   {
-    lock_release (&open_inodes_lock);
+    free (inode);
     return NULL;
   }
 
+  /* Someone else may have opened it in the meantime. */
+  lock_acquire (&open_inodes_lock);
+  other = open_inodes_find (sector);
+  if (other != NULL)
+    {
+      if (other->removed)
+        other = NULL;
+      else
+        other->open_cnt++;
+      lock_release (&open_inodes_lock);
+      free (inode);
+      return other;
+    }
+
   /* Initialize. */
+  inode->leaf_sector = 0;
+  inode->alloc_goal = sector + 1;
   lock_init (&inode->mutex);
   lock_init (&inode->dir_mutex);
+  list_init (&inode->ranges);
+  cond_init (&inode->range_released);
   inode->sector = sector;
+  inode->key.sector = sector;
   inode->removed = false;
   inode->open_cnt = 1;
   inode->deny_write_cnt = 0;
-  list_push_front (&open_inodes, &inode->elem);
+  hash_insert (&open_inodes, &inode->key.elem);
   lock_release (&open_inodes_lock);
   return inode;
 }
@@ -291,10 +1183,12 @@ inode_reopen (struct inode *inode)
   struct inode * result = inode;
   if (inode != NULL)
   {
+    lock_acquire (&open_inodes_lock);
     if (inode->removed)
       result = NULL;
     else
       result->open_cnt++;
+    lock_release (&open_inodes_lock);
   }
   return result;
 }
@@ -317,47 +1211,23 @@ inode_close (struct inode *inode)
     return;
 
   lock_acquire (&open_inodes_lock);
-  inode_lock (inode);
+  bool last = --inode->open_cnt == 0;
+  if (last)
+    hash_delete (&open_inodes, &inode->key.elem);
+  lock_release (&open_inodes_lock);
 
-  /* Release resources if this was the last opener. */
-  if (--inode->open_cnt == 0)
+  /* Release resources if this was the last opener. Nobody can find
+     INODE anymore, but a thread that is done with it may still be
+     releasing its mutex. */
+  if (last)
     {
-      /* Remove from inode list and release lock. */
-      list_remove (&inode->elem);
-      lock_release (&open_inodes_lock);
- 
+      inode_lock (inode);
       /* Deallocate blocks if removed. */
       if (inode->removed) 
-        {
-          size_t length = inode_length (inode);
-          size_t pos;
-          disk_sector_t sector;
-          bool success = true;
-          for (pos = 0; pos < length; pos += DISK_SECTOR_SIZE)
-          {
-            sector = byte_to_sector (inode->sector, pos, false);
-            if ((int)sector == -1)
-            {
-              success = false;
-              break;
-            }
-            if (sector > 0)
-            {
-              buffer_cache_remove (sector);
-              free_map_release (sector, 1);
-            }
-          }
-          buffer_cache_remove (inode->sector);
-          free_map_release (inode->sector, 1);
-        }
+        inode_deallocate (inode);
       inode_unlock (inode);
       free (inode); 
     }
-  else
-    {
-      lock_release (&open_inodes_lock);
-      inode_unlock (inode);
-    }
 }
 
 /* Marks INODE to be deleted when it is closed by the last caller who
@@ -376,11 +1246,106 @@ inode_remove (struct inode *inode)
    Returns the number of bytes actually read, which may be less
    than SIZE if an error occurs or end of file is reached. */
 off_t
-inode_read_at (struct inode *inode_, void *buffer_, off_t size, off_t offset)
+inode_read_at (struct inode *inode, void *buffer, off_t size, off_t offset)
+{
+  return inode_read_ahead_at (inode, buffer, size, offset, NULL);
+}
+
+/* Initializes RA for an opener that has not read anything yet. A read
+ * from the beginning of the file counts as sequential. */
+void
+inode_read_ahead_init (struct read_ahead * ra)
+{
+  ra->next = 0;
+  ra->ahead = 0;
+  ra->window = 1;
+}
+
+/* Updates RA for a read starting at OFFSET. The window doubles up to
+ * READ_AHEAD_MAX while reads are sequential and collapses on the first
+ * random access. */
+static void
+read_ahead_update (struct read_ahead * ra, off_t offset)
+{
+  if (offset == ra->next)
+  {
+    ra->window = ra->window == 0 ? 1 : ra->window * 2;
+    if (ra->window > READ_AHEAD_MAX)
+      ra->window = READ_AHEAD_MAX;
+  }
+  else
+  {
+    ra->window = 0;
+    ra->ahead = 0;
+  }
+}
+
+/* Asks the cache to read ahead the sectors of INODE within RA's window
+ * past OFFSET that have not been requested yet. Stops at the first one
+ * the cache drops, which is requested again by the next read. */
+static void
+read_ahead_issue (struct inode * inode, struct read_ahead * ra, off_t offset)
+{
+  off_t pos = ROUND_UP (offset, DISK_SECTOR_SIZE);
+  off_t end = offset + ra->window * DISK_SECTOR_SIZE;
+  disk_sector_t sector;
+  if (pos < ra->ahead)
+    pos = ra->ahead;
+  if (pos >= end)
+    return;
+  inode_lock (inode);
+  /* There is no sector to read ahead. */
+  if (inode->sector != FREE_MAP_SECTOR
+      && inode->data.disk.magic == INLINE_MAGIC)
+  {
+    inode_unlock (inode);
+    return;
+  }
+  off_t length = inode_length (inode);
+  if (end > length)
+    end = length;
+  for (; pos < end; pos += DISK_SECTOR_SIZE)
+  {
+    sector = byte_to_sector (inode, pos, false);
+    /* Hole, error, or too many requests pending. */
+    if ((int)sector < 1 || !buffer_cache_read_ahead (sector))
+      break;
+  }
+  inode_unlock (inode);
+  ra->ahead = pos;
+}
+
+/* Reads SIZE bytes from INODE into BUFFER, starting at position
+ * OFFSET, with the bytes locked for reading. Returns the number of
+ * bytes actually read. */
+static off_t
+inode_read_range (struct inode *inode_, void *buffer_, off_t size,
+                  off_t offset)
 {
   off_t bytes_read = 0;
   uint8_t * buffer = buffer_;
-  disk_sector_t inode = inode_->sector;
+  struct range_lock range;
+
+  range_acquire (inode_, &range, offset, offset + size, false);
+
+  /* Data inside the inode is copied out at once. Files only ever move
+   * their data out of the inode, so the loop below needs no check. */
+  inode_lock (inode_);
+  if (inode_->sector != FREE_MAP_SECTOR
+      && inode_->data.disk.magic == INLINE_MAGIC)
+  {
+    off_t inode_len = inode_length (inode_);
+    if (size > inode_len - offset)
+      size = inode_len - offset;
+    if (size > 0)
+    {
+      memcpy (buffer, inode_->data.disk.map.data + offset, size);
+      bytes_read = size;
+      offset += size;
+    }
+    size = 0;
+  }
+  inode_unlock (inode_);
 
   while (size > 0) 
     {
@@ -399,24 +1364,18 @@ inode_read_at (struct inode *inode_, void *buffer_, off_t size, off_t offset)
         break;
       }
       /* Disk sector to read, starting byte offset within sector. */
-      disk_sector_t sector_idx = byte_to_sector (inode, offset, true);
-      /* If 0, there is no data. If -1, error has occurred. */
-      if ((int)sector_idx < 1)
-      {
-        inode_unlock (inode_);
-        break;
-      }
-      disk_sector_t sector_next;
-      sector_next = byte_to_sector (inode, offset + DISK_SECTOR_SIZE, false);
-      if ((int)sector_next == -1)
-      {
-        inode_unlock (inode_);
-        break;
-      }
+      disk_sector_t sector_idx = byte_to_sector (inode_, offset, false);
       inode_unlock (inode_);
+      /* If -1, error has occurred. */
+      if ((int)sector_idx == -1)
+        break;
 
-      if (!buffer_cache_read (sector_idx, sector_next, sector_ofs, chunk_size,
-                              buffer + bytes_read))
+      /* If 0, the sector is a hole, which reads as zeros. It is only
+       * allocated when written. */
+      if (sector_idx == 0)
+        memset (buffer + bytes_read, 0, chunk_size);
+      else if (!buffer_cache_read (sector_idx, sector_ofs, chunk_size,
+                                   buffer + bytes_read))
         break;
       
       /* Advance. */
@@ -425,36 +1384,106 @@ inode_read_at (struct inode *inode_, void *buffer_, off_t size, off_t offset)
       inode_left -= chunk_size;
       bytes_read += chunk_size;
     }
+  range_release (inode_, &range);
+  return bytes_read;
+}
+
+/* Same as inode_read_at, but uses and updates the sequential access
+ * state RA of the opener to read ahead the sectors that are likely to
+ * be read next. RA may be a null pointer, which disables read ahead.
+ *
+ * User memory in BUFFER must not fault while the bytes are locked,
+ * since the fault may come back into this very file, through a page
+ * mapped from it. The system calls pin it in memory beforehand. */
+off_t
+inode_read_ahead_at (struct inode *inode, void *buffer, off_t size,
+                     off_t offset, struct read_ahead * ra)
+{
+  off_t bytes_read;
 
+  if (ra != NULL)
+    read_ahead_update (ra, offset);
+  bytes_read = inode_read_range (inode, buffer, size, offset);
+
+  if (ra != NULL)
+  {
+    ra->next = offset + bytes_read;
+    if (ra->window > 0)
+      read_ahead_issue (inode, ra, offset + bytes_read);
+  }
   return bytes_read;
 }
 
 /* Writes SIZE bytes from BUFFER into INODE, starting at OFFSET.
    Returns the number of bytes actually written, which may be
-   less than SIZE if end of file is reached or an error occurs.
-   (Normally a write at end of file would extend the inode, but
-   growth is not yet implemented.) */
+   less than SIZE if an error occurs or writes are denied.
+   The bytes are locked for writing throughout, so as in
+   inode_read_ahead_at, user memory in BUFFER must be pinned. */
 off_t
 inode_write_at (struct inode *inode_, const void *buffer_, off_t size,
-                off_t offset) 
+                off_t offset)
 {
   const uint8_t *buffer = buffer_;
   off_t bytes_written = 0;
-  disk_sector_t inode = inode_->sector;
+  off_t * length = inode_length_field (inode_);
+  bool extended = false;
+  struct range_lock range;
+  struct reservation res;
+  size_t first = offset / DISK_SECTOR_SIZE;
+  size_t end = bytes_to_sectors (offset + size);
 
   if (inode_->deny_write_cnt)
     return 0;
 
+  /* Whole blocks, since new sectors are zeroed with the inode unlocked. */
+  range_acquire (inode_, &range, first * DISK_SECTOR_SIZE,
+                 end * DISK_SECTOR_SIZE, true);
   inode_lock (inode_);
-  off_t length = inode_length (inode_);
+  if (inode_->sector != FREE_MAP_SECTOR && size > 0
+      && inode_->data.disk.magic == INLINE_MAGIC)
+  {
+    /* Written in place if the data still fits in the inode. */
+    if (offset + size <= (off_t) INLINE_MAX)
+    {
+      uint8_t * data = inode_->data.disk.map.data;
+      memcpy (data + offset, buffer, size);
+      inode_write_back (inode_, data + offset, size);
+      if (*length < offset + size)
+      {
+        *length = offset + size;
+        inode_write_back (inode_, length, sizeof *length);
+      }
+      inode_unlock (inode_);
+      range_release (inode_, &range);
+      return size;
+    }
+    if (!inline_to_extents (inode_))
+    {
+      inode_unlock (inode_);
+      range_release (inode_, &range);
+      return 0;
+    }
+  }
+  /* Allocate the sectors the write needs at once, so that they are
+   * consecutive and the free map is updated only a few times. Whatever
+   * is left is allocated sector by sector below. */
+  res.cnt = 0;
+  if (inode_->sector != FREE_MAP_SECTOR && size > 0)
+    blocks_reserve (inode_, first, end, &res);
   inode_unlock (inode_);
-  if (length < 0) return 0;
+  /* The write overwrites the new sectors whole, except the first and
+   * the last one if it starts or ends inside them. */
+  if (offset % DISK_SECTOR_SIZE != 0)
+    reservation_zero (&res, first, first + 1);
+  if ((offset + size) % DISK_SECTOR_SIZE != 0
+      && (end - 1 != first || offset % DISK_SECTOR_SIZE == 0))
+    reservation_zero (&res, end - 1, end);
 
   while (size > 0) 
     {
       /* Sector to write, starting byte offset within sector. */
       inode_lock (inode_);
-      disk_sector_t sector_idx = byte_to_sector (inode, offset, true);
+      disk_sector_t sector_idx = byte_to_sector (inode_, offset, true);
       inode_unlock (inode_);
       if ((int)sector_idx == -1) break;
       int sector_ofs = offset % DISK_SECTOR_SIZE;
@@ -472,17 +1501,223 @@ inode_write_at (struct inode *inode_, const void *buffer_, off_t size,
       size -= chunk_size;
       offset += chunk_size;
       bytes_written += chunk_size;
-      /* Update length. */
-      inode_lock (inode_);
-      length = inode_length (inode_);
-      if (length < offset)
-        inode_set_length (inode_, offset);
-      inode_unlock (inode_);
+      /* Update length. Only a writer that holds the tail of the file
+       * takes the mutex for it. Readers see it at once, but it is
+       * written back only once the whole write is done. */
+      if (range.end == RANGE_EOF && *length < offset)
+      {
+        inode_lock (inode_);
+        if (*length < offset)
+        {
+          *length = offset;
+          extended = true;
+        }
+        inode_unlock (inode_);
+      }
     }
+  /* The new sectors the write did not reach must not keep what the disk
+   * held before. */
+  if (size > 0)
+    reservation_zero (&res, bytes_to_sectors (offset), end);
 
+  if (extended)
+  {
+    inode_lock (inode_);
+    inode_write_back (inode_, length, sizeof *length);
+    inode_unlock (inode_);
+  }
+  range_release (inode_, &range);
   return bytes_written;
 }
 
+/* Returns the offset of the first byte at or after POS in INODE that
+ * is in a hole if HOLE is true, or in an allocated sector otherwise.
+ * The end of the file counts as the start of a hole, and is returned
+ * if there is no such byte. Returns -1 when error occurs. */
+static off_t
+inode_seek (struct inode * inode, off_t pos, bool hole)
+{
+  inode_lock (inode);
+  off_t length = inode_length (inode);
+  /* Data inside the inode has no holes. */
+  if (inode->sector != FREE_MAP_SECTOR
+      && inode->data.disk.magic == INLINE_MAGIC)
+    pos = hole ? length : pos;
+  while (pos < length)
+  {
+    disk_sector_t sector = byte_to_sector (inode, pos, false);
+    if ((int)sector == -1)
+    {
+      pos = -1;
+      break;
+    }
+    if ((sector == 0) == hole)
+      break;
+    pos = ROUND_DOWN (pos, DISK_SECTOR_SIZE) + DISK_SECTOR_SIZE;
+  }
+  inode_unlock (inode);
+  return pos < length ? pos : length;
+}
+
+/* Returns the offset of the first byte at or after POS in INODE that
+ * is stored on disk, or the length of INODE if there is none. Returns
+ * -1 when error occurs. */
+off_t
+inode_seek_data (struct inode * inode, off_t pos)
+{
+  return inode_seek (inode, pos, false);
+}
+
+/* Returns the offset of the first byte at or after POS in INODE that
+ * is in a hole, which reads as zero without being stored, or the length
+ * of INODE if there is none. Returns -1 when error occurs. */
+off_t
+inode_seek_hole (struct inode * inode, off_t pos)
+{
+  return inode_seek (inode, pos, true);
+}
+
+/* Allocates the blocks of the first LENGTH bytes of INODE that are not
+ * allocated yet, in as few runs of consecutive sectors as possible,
+ * without changing its length. Writers that know the final size of a
+ * file call this first so that the file is not fragmented. Returns
+ * false if writes to INODE are denied or the disk is full. */
+bool
+inode_reserve (struct inode * inode, off_t length)
+{
+  size_t end = bytes_to_sectors (length);
+  bool success = true;
+  struct range_lock range;
+  ASSERT (inode->sector != FREE_MAP_SECTOR);
+  ASSERT (length >= 0);
+  range_acquire (inode, &range, 0, length, true);
+  inode_lock (inode);
+  if (inode->deny_write_cnt)
+  {
+    inode_unlock (inode);
+    range_release (inode, &range);
+    return false;
+  }
+  if (inode->data.disk.magic == INLINE_MAGIC && length > (off_t) INLINE_MAX)
+    success = inline_to_extents (inode);
+  success = success && blocks_reserve_zeroed (inode, 0, end);
+  inode_unlock (inode);
+  range_release (inode, &range);
+  return success;
+}
+
+/* Sets the length of INODE to LENGTH bytes. Growing only moves the end
+ * of the file, and the new bytes read as zeros. Shrinking frees every
+ * block past the new end, including reserved ones, in runs of
+ * consecutive sectors. Returns
+ * false if writes to INODE are denied. */
+bool
+inode_truncate (struct inode * inode, off_t length)
+{
+  struct range_lock range;
+  ASSERT (inode->sector != FREE_MAP_SECTOR);
+  ASSERT (length >= 0);
+  /* Moves the end of file, and may free blocks anywhere past it. */
+  range_acquire (inode, &range, 0, RANGE_EOF, true);
+  inode_lock (inode);
+  if (inode->deny_write_cnt)
+  {
+    inode_unlock (inode);
+    range_release (inode, &range);
+    return false;
+  }
+  if (inode->data.disk.magic == INLINE_MAGIC)
+  {
+    struct inode_disk * disk_inode = &inode->data.disk;
+    if (length > (off_t) INLINE_MAX)
+    {
+      if (!inline_to_extents (inode))
+      {
+        inode_unlock (inode);
+        range_release (inode, &range);
+        return false;
+      }
+    }
+    else if (length < disk_inode->length)
+    {
+      /* Cleared, so that they read as zeros if the file grows again. */
+      memset (disk_inode->map.data + length, 0,
+              disk_inode->length - length);
+      inode_write_back (inode, disk_inode->map.data + length,
+                        disk_inode->length - length);
+    }
+  }
+  else if (length < inode->data.disk.length)
+  {
+    struct free_run run = {0, 0};
+    size_t first = bytes_to_sectors (length);
+    int tail = length % DISK_SECTOR_SIZE;
+    /* Clear the rest of the last sector, which reads as zeros if the
+     * file grows again. */
+    if (tail > 0)
+    {
+      disk_sector_t sector = byte_to_sector (inode, length, false);
+      if ((int)sector > 0)
+        buffer_cache_write (sector, tail, 0, NULL, true);
+    }
+    inode_free_tail (inode, &run, first);
+    free_run_flush (&run);
+    inode_write_back (inode, &inode->data.disk.map,
+                      sizeof inode->data.disk.map);
+  }
+  inode->data.disk.length = length;
+  inode_write_back (inode, &inode->data.disk.length, sizeof length);
+  inode_unlock (inode);
+  range_release (inode, &range);
+  return true;
+}
+
+/* Allocates the blocks of INODE that hold the LEN bytes starting at
+ * OFFSET, in as few runs of consecutive sectors as possible, and grows
+ * INODE to OFFSET + LEN bytes if it is shorter. Returns false if writes
+ * to INODE are denied or the disk is full. */
+bool
+inode_allocate (struct inode * inode, off_t offset, off_t len)
+{
+  size_t first = offset / DISK_SECTOR_SIZE;
+  size_t end = bytes_to_sectors (offset + len);
+  size_t block;
+  bool success = true;
+  struct range_lock range;
+  ASSERT (inode->sector != FREE_MAP_SECTOR);
+  ASSERT (offset >= 0 && len >= 0);
+  /* Whole blocks, since new sectors are zeroed with the inode unlocked. */
+  range_acquire (inode, &range, first * DISK_SECTOR_SIZE,
+                 end * DISK_SECTOR_SIZE, true);
+  inode_lock (inode);
+  if (inode->deny_write_cnt)
+  {
+    inode_unlock (inode);
+    range_release (inode, &range);
+    return false;
+  }
+  if (inode->data.disk.magic == INLINE_MAGIC
+      && offset + len > (off_t) INLINE_MAX)
+    success = inline_to_extents (inode);
+  success = success && blocks_reserve_zeroed (inode, first, end);
+  /* Blocks extent_reserve had no room for. Allocated blocks are only
+   * looked up. Data that still fits in the inode needs none. */
+  if (inode->data.disk.magic == INLINE_MAGIC)
+    end = first;
+  for (block = first; success && block < end; ++block)
+    if ((int)byte_to_sector (inode, block * DISK_SECTOR_SIZE, true) == -1)
+      success = false;
+  if (success && inode->data.disk.length < offset + len)
+  {
+    inode->data.disk.length = offset + len;
+    inode_write_back (inode, &inode->data.disk.length,
+                      sizeof inode->data.disk.length);
+  }
+  inode_unlock (inode);
+  range_release (inode, &range);
+  return success;
+}
+
 /* Disables writes to INODE.
    May be called at most once per inode opener. */
 void
@@ -507,21 +1742,13 @@ inode_allow_write (struct inode *inode)
   inode_unlock (inode);
 }
 
-/* Returns the length, in bytes, of INODE's data. Returns -1 when error
- * occurs.*/
+/* Returns the length, in bytes, of INODE's data. */
 off_t
 inode_length (const struct inode *inode)
 {
-  off_t length;
-  off_t offset;
   if (inode->sector == FREE_MAP_SECTOR)
-    offset = sizeof (disk_sector_t);
-  else
-    offset = sizeof (uint32_t);
-  if (!buffer_cache_read (inode->sector, END_OF_FILE, offset, sizeof (length),
-                          &length))
-    return -1;
-  return length;
+    return inode->data.disk_0.length;
+  return inode->data.disk.length;
 }
 
 void
@@ -551,8 +1778,18 @@ inode_dir_unlock (struct inode * inode)
 bool
 inode_is_opened (struct inode * inode)
 {
-  inode_lock (inode);
+  lock_acquire (&open_inodes_lock);
   bool result = (inode->open_cnt != 1);
+  lock_release (&open_inodes_lock);
+  return result;
+}
+
+/* Returns true if INODE has been removed. */
+bool
+inode_is_removed (struct inode * inode)
+{
+  inode_lock (inode);
+  bool result = inode->removed;
   inode_unlock (inode);
   return result;
 }
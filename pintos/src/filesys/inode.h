@@ -2,12 +2,21 @@
 #define FILESYS_INODE_H
 
 #include <stdbool.h>
+#include <stddef.h>
 #include "filesys/off_t.h"
 #include "devices/disk.h"
 
 struct bitmap;
 enum inode_type { TYPE_DIR, TYPE_FILE, TYPE_ERROR };
 
+/* Sequential access detection state kept by each opener. */
+struct read_ahead
+  {
+    off_t next;                 /* Offset a sequential read starts at. */
+    off_t ahead;                /* Read ahead already issued up to here. */
+    size_t window;              /* Number of sectors to read ahead. */
+  };
+
 void inode_init (void);
 bool inode_create (disk_sector_t, off_t, uint32_t);
 struct inode *inode_open (disk_sector_t);
@@ -20,11 +29,20 @@ void inode_dir_lock (struct inode *);
 void inode_dir_unlock (struct inode *);
 void inode_remove (struct inode *);
 off_t inode_read_at (struct inode *, void *, off_t size, off_t offset);
+void inode_read_ahead_init (struct read_ahead *);
+off_t inode_read_ahead_at (struct inode *, void *, off_t size, off_t offset,
+                           struct read_ahead *);
 off_t inode_write_at (struct inode *, const void *, off_t size, off_t offset);
+off_t inode_seek_data (struct inode *, off_t pos);
+off_t inode_seek_hole (struct inode *, off_t pos);
+bool inode_reserve (struct inode *, off_t length);
+bool inode_truncate (struct inode *, off_t length);
+bool inode_allocate (struct inode *, off_t offset, off_t len);
 void inode_deny_write (struct inode *);
 void inode_allow_write (struct inode *);
 off_t inode_length (const struct inode *);
 uint32_t inode_get_type (const struct inode *);
 bool inode_is_opened (struct inode *);
+bool inode_is_removed (struct inode *);
 
 #endif /* filesys/inode.h */
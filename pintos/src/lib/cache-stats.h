@@ -0,0 +1,22 @@
+#ifndef __LIB_CACHE_STATS_H
+#define __LIB_CACHE_STATS_H
+
+/* Buffer cache statistics, counted since boot. Shared by the kernel and
+ * user programs, which obtain a snapshot with the cachestat system
+ * call. */
+struct cache_stats
+  {
+    unsigned long long hits;            /* Lookups that found the sector. */
+    unsigned long long misses;          /* Lookups that missed. */
+    unsigned long long write_allocs;    /* Misses filled without a read. */
+    unsigned long long evictions;       /* Elements reused for a sector. */
+    unsigned long long dirty_evictions; /* Evictions that wrote back. */
+    unsigned long long flushes;         /* Write behind passes. */
+    unsigned long long flushed;         /* Sectors written by them. */
+    unsigned long long read_ahead;      /* Sectors read ahead. */
+    unsigned long long read_ahead_hits; /* Read ahead sectors used. */
+    unsigned long long read_ahead_wasted; /* Evicted before use. */
+    unsigned long long ready_waits;     /* Hits waiting for a disk read. */
+  };
+
+#endif /* lib/cache-stats.h */
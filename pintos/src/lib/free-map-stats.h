@@ -0,0 +1,18 @@
+#ifndef __LIB_FREE_MAP_STATS_H
+#define __LIB_FREE_MAP_STATS_H
+
+#include <stddef.h>
+
+/* Free space statistics. Shared by the kernel and user programs, which
+ * obtain a snapshot with the freestat system call. Fragmentation is the
+ * share of free sectors outside the longest free run: none when all
+ * free space is in one piece. */
+struct free_map_stats
+  {
+    size_t sectors;                     /* Sectors on the disk. */
+    size_t free;                        /* Free sectors. */
+    size_t free_runs;                   /* Runs of consecutive free ones. */
+    size_t largest_run;                 /* Length of the longest run. */
+  };
+
+#endif /* lib/free-map-stats.h */
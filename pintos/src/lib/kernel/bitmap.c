@@ -3,6 +3,7 @@
 #include <limits.h>
 #include <round.h>
 #include <stdio.h>
+#include <string.h>
 #include "threads/malloc.h"
 #ifdef FILESYS
 #include "filesys/file.h"
@@ -359,6 +360,23 @@ bitmap_write (const struct bitmap *b, struct file *file)
   off_t size = byte_cnt (b->bit_cnt);
   return file_write_at (file, b->bits, size, 0) == size;
 }
+
+/* Copies the SIZE bytes of B's file image starting at byte OFS
+   into BUF, or as many of them as B has, so that they can be
+   written to the file at the same offset.  Returns the number of
+   bytes copied. */
+size_t
+bitmap_copy_part (const struct bitmap *b, size_t ofs, size_t size,
+                  void *buf)
+{
+  size_t total = byte_cnt (b->bit_cnt);
+  if (ofs >= total)
+    return 0;
+  if (size > total - ofs)
+    size = total - ofs;
+  memcpy (buf, (const char *) b->bits + ofs, size);
+  return size;
+}
 #endif /* FILESYS */
 
 /* Debugging. */
@@ -28,7 +28,16 @@ enum
     SYS_MKDIR,                  /* Create a directory. */
     SYS_READDIR,                /* Reads a directory entry. */
     SYS_ISDIR,                  /* Tests if a fd represents a directory. */
-    SYS_INUMBER                 /* Returns the inode number for a fd. */
+    SYS_INUMBER,                /* Returns the inode number for a fd. */
+
+    /* Extensions. */
+    SYS_CACHESTAT,              /* Reports buffer cache statistics. */
+    SYS_SEEKDATA,               /* Finds data in a file past a position. */
+    SYS_SEEKHOLE,               /* Finds a hole in a file past a position. */
+    SYS_PREALLOCATE,            /* Allocates a file's blocks in advance. */
+    SYS_TRUNCATE,               /* Changes the size of a file. */
+    SYS_FALLOCATE,              /* Allocates a range of a file. */
+    SYS_FREESTAT                /* Reports free space statistics. */
   };
 
 #endif /* lib/syscall-nr.h */
@@ -182,3 +182,45 @@ inumber (int fd)
 {
   return syscall1 (SYS_INUMBER, fd);
 }
+
+void
+cachestat (struct cache_stats *stats)
+{
+  syscall1 (SYS_CACHESTAT, stats);
+}
+
+int
+seekdata (int fd, unsigned position)
+{
+  return syscall2 (SYS_SEEKDATA, fd, position);
+}
+
+int
+seekhole (int fd, unsigned position)
+{
+  return syscall2 (SYS_SEEKHOLE, fd, position);
+}
+
+bool
+preallocate (int fd, unsigned size)
+{
+  return syscall2 (SYS_PREALLOCATE, fd, size);
+}
+
+bool
+truncate (int fd, unsigned size)
+{
+  return syscall2 (SYS_TRUNCATE, fd, size);
+}
+
+bool
+fallocate (int fd, unsigned offset, unsigned length)
+{
+  return syscall3 (SYS_FALLOCATE, fd, offset, length);
+}
+
+void
+freestat (struct free_map_stats *stats)
+{
+  syscall1 (SYS_FREESTAT, stats);
+}
@@ -3,6 +3,8 @@
 
 #include <stdbool.h>
 #include <debug.h>
+#include <cache-stats.h>
+#include <free-map-stats.h>
 
 /* Process identifier. */
 typedef int pid_t;
@@ -45,4 +47,13 @@ bool readdir (int fd, char name[READDIR_MAX_LEN + 1]);
 bool isdir (int fd);
 int inumber (int fd);
 
+/* Extensions. */
+void cachestat (struct cache_stats *);
+int seekdata (int fd, unsigned position);
+int seekhole (int fd, unsigned position);
+bool preallocate (int fd, unsigned size);
+bool truncate (int fd, unsigned size);
+bool fallocate (int fd, unsigned offset, unsigned length);
+void freestat (struct free_map_stats *);
+
 #endif /* lib/user/syscall.h */
@@ -0,0 +1,36 @@
+/* Reads back a file that was just written and checks that cachestat
+   counts the reads as hits in the buffer cache. */
+
+#include <random.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+static char buf[4096];
+
+void
+test_main (void) 
+{
+  const char *file_name = "testfile";
+  struct cache_stats before, after;
+  int fd;
+
+  random_bytes (buf, sizeof buf);
+  CHECK (create (file_name, 0), "create \"%s\"", file_name);
+  CHECK ((fd = open (file_name)) > 1, "open \"%s\"", file_name);
+  CHECK (write (fd, buf, sizeof buf) == (int) sizeof buf,
+         "write \"%s\"", file_name);
+  msg ("seek \"%s\"", file_name);
+  seek (fd, 0);
+  cachestat (&before);
+  CHECK (read (fd, buf, sizeof buf) == (int) sizeof buf,
+         "read \"%s\"", file_name);
+  cachestat (&after);
+  CHECK (after.hits - before.hits >= sizeof buf / 512,
+         "every sector read is a hit");
+  CHECK (after.hits + after.misses > before.hits + before.misses,
+         "lookups are counted");
+  msg ("close \"%s\"", file_name);
+  close (fd);
+  check_file (file_name, buf, sizeof buf);
+}
@@ -0,0 +1,20 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(cache-stat) begin
+(cache-stat) create "testfile"
+(cache-stat) open "testfile"
+(cache-stat) write "testfile"
+(cache-stat) seek "testfile"
+(cache-stat) read "testfile"
+(cache-stat) every sector read is a hit
+(cache-stat) lookups are counted
+(cache-stat) close "testfile"
+(cache-stat) open "testfile" for verification
+(cache-stat) verified contents of "testfile"
+(cache-stat) close "testfile"
+(cache-stat) end
+EOF
+pass;
@@ -0,0 +1,48 @@
+/* Child process for syn-range test.
+   Writes its part of a test file and reads it back, several times.
+   Another process is doing the same with the next part at the same
+   time. */
+
+#include <random.h>
+#include <stdlib.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/filesys/extended/syn-range.h"
+
+static char buf[BUF_SIZE];
+static char data[CHUNK_SIZE];
+
+int
+main (int argc, char *argv[])
+{
+  int child_idx;
+  size_t ofs;
+  int fd;
+  int i;
+
+  test_name = "child-syn-rng";
+  quiet = true;
+
+  CHECK (argc == 2, "argc must be 2, actually %d", argc);
+  child_idx = atoi (argv[1]);
+  ofs = CHUNK_SIZE * child_idx;
+
+  random_init (0);
+  random_bytes (buf, sizeof buf);
+
+  CHECK ((fd = open (file_name)) > 1, "open \"%s\"", file_name);
+  for (i = 0; i < WRITE_CNT; i++)
+    {
+      seek (fd, ofs);
+      CHECK (write (fd, buf + ofs, CHUNK_SIZE) == CHUNK_SIZE,
+             "write \"%s\"", file_name);
+      seek (fd, ofs);
+      CHECK (read (fd, data, CHUNK_SIZE) == CHUNK_SIZE,
+             "read \"%s\"", file_name);
+      compare_bytes (data, buf + ofs, CHUNK_SIZE, ofs, file_name);
+    }
+  msg ("close \"%s\"", file_name);
+  close (fd);
+
+  return child_idx;
+}
@@ -0,0 +1,33 @@
+/* Allocates a range of a file past its end with fallocate and checks
+   that the file grows to cover it, that the range reads as zeros and
+   that it is stored on disk while the gap before it stays a hole. */
+
+#include <random.h>
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+static char buf[5000];
+
+void
+test_main (void) 
+{
+  const char *file_name = "testfile";
+  int fd;
+
+  random_bytes (buf, 100);
+  CHECK (create (file_name, 0), "create \"%s\"", file_name);
+  CHECK ((fd = open (file_name)) > 1, "open \"%s\"", file_name);
+  CHECK (write (fd, buf, 100) == 100, "write \"%s\"", file_name);
+  CHECK (!fallocate (fd, -1, 512), "fallocate at negative offset fails");
+  CHECK (fallocate (fd, 2000, 3000), "fallocate 3000 bytes at 2000");
+  CHECK (filesize (fd) == (int) sizeof buf, "filesize \"%s\"", file_name);
+  CHECK (seekhole (fd, 0) == 512, "seekhole from 0");
+  CHECK (seekdata (fd, 512) == 1536, "seekdata from 512");
+  CHECK (seekhole (fd, 1536) == (int) sizeof buf, "seekhole from 1536");
+  msg ("close \"%s\"", file_name);
+  close (fd);
+  memset (buf + 100, 0, sizeof buf - 100);
+  check_file (file_name, buf, sizeof buf);
+}
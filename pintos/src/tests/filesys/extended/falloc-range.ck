@@ -0,0 +1,22 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(falloc-range) begin
+(falloc-range) create "testfile"
+(falloc-range) open "testfile"
+(falloc-range) write "testfile"
+(falloc-range) fallocate at negative offset fails
+(falloc-range) fallocate 3000 bytes at 2000
+(falloc-range) filesize "testfile"
+(falloc-range) seekhole from 0
+(falloc-range) seekdata from 512
+(falloc-range) seekhole from 1536
+(falloc-range) close "testfile"
+(falloc-range) open "testfile" for verification
+(falloc-range) verified contents of "testfile"
+(falloc-range) close "testfile"
+(falloc-range) end
+EOF
+pass;
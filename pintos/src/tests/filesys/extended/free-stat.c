@@ -0,0 +1,36 @@
+/* Checks that the free space statistics freestat reports are
+   consistent, and that writing a file takes free sectors. */
+
+#include <random.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+static char buf[5120];
+
+void
+test_main (void) 
+{
+  const char *file_name = "testfile";
+  struct free_map_stats before, after;
+  int fd;
+
+  random_bytes (buf, sizeof buf);
+  freestat (&before);
+  CHECK (before.sectors > 0 && before.free <= before.sectors,
+         "free sectors within disk");
+  CHECK (before.largest_run <= before.free,
+         "longest free run within free sectors");
+  CHECK ((before.free == 0) == (before.free_runs == 0),
+         "free runs match free sectors");
+  CHECK (create (file_name, 0), "create \"%s\"", file_name);
+  CHECK ((fd = open (file_name)) > 1, "open \"%s\"", file_name);
+  CHECK (write (fd, buf, sizeof buf) == (int) sizeof buf,
+         "write \"%s\"", file_name);
+  freestat (&after);
+  CHECK (after.free + sizeof buf / 512 <= before.free,
+         "write takes free sectors");
+  msg ("close \"%s\"", file_name);
+  close (fd);
+  check_file (file_name, buf, sizeof buf);
+}
@@ -0,0 +1,20 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(free-stat) begin
+(free-stat) free sectors within disk
+(free-stat) longest free run within free sectors
+(free-stat) free runs match free sectors
+(free-stat) create "testfile"
+(free-stat) open "testfile"
+(free-stat) write "testfile"
+(free-stat) write takes free sectors
+(free-stat) close "testfile"
+(free-stat) open "testfile" for verification
+(free-stat) verified contents of "testfile"
+(free-stat) close "testfile"
+(free-stat) end
+EOF
+pass;
@@ -0,0 +1,22 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(grow-frag) begin
+(grow-frag) create "a"
+(grow-frag) create "b"
+(grow-frag) open "a"
+(grow-frag) open "b"
+(grow-frag) write "a" and "b" alternately, one sector at a time
+(grow-frag) close "a"
+(grow-frag) close "b"
+(grow-frag) open "a" for verification
+(grow-frag) verified contents of "a"
+(grow-frag) close "a"
+(grow-frag) open "b" for verification
+(grow-frag) verified contents of "b"
+(grow-frag) close "b"
+(grow-frag) end
+EOF
+pass;
@@ -0,0 +1,30 @@
+/* Grows a file to 499 bytes, which fit in its inode, and then by
+   two more bytes, which do not, and checks its contents on each
+   side of the move out of the inode. */
+
+#include <random.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+static char buf[501];
+
+void
+test_main (void) 
+{
+  const char *file_name = "testfile";
+  int fd;
+
+  random_bytes (buf, sizeof buf);
+  CHECK (create (file_name, 0), "create \"%s\"", file_name);
+  CHECK ((fd = open (file_name)) > 1, "open \"%s\"", file_name);
+  CHECK (write (fd, buf, 499) == 499, "write 499 bytes to \"%s\"",
+         file_name);
+  check_file (file_name, buf, 499);
+  CHECK (write (fd, buf + 499, 2) == 2, "write 2 more bytes to \"%s\"",
+         file_name);
+  CHECK (filesize (fd) == (int) sizeof buf, "filesize \"%s\"", file_name);
+  msg ("close \"%s\"", file_name);
+  close (fd);
+  check_file (file_name, buf, sizeof buf);
+}
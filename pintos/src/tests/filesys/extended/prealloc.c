@@ -0,0 +1,36 @@
+/* Preallocates a file and checks that its size does not change, that
+   the space is taken from the free map at once and that writing the
+   file afterward takes no more. */
+
+#include <random.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+static char buf[20480];
+
+void
+test_main (void) 
+{
+  const char *file_name = "testfile";
+  struct free_map_stats before, reserved, written;
+  int fd;
+
+  random_bytes (buf, sizeof buf);
+  CHECK (create (file_name, 0), "create \"%s\"", file_name);
+  CHECK ((fd = open (file_name)) > 1, "open \"%s\"", file_name);
+  freestat (&before);
+  CHECK (!preallocate (fd, -1), "preallocate negative size fails");
+  CHECK (preallocate (fd, sizeof buf), "preallocate \"%s\"", file_name);
+  CHECK (filesize (fd) == 0, "filesize \"%s\" unchanged", file_name);
+  freestat (&reserved);
+  CHECK (before.free - reserved.free >= sizeof buf / 512,
+         "preallocate takes free sectors");
+  CHECK (write (fd, buf, sizeof buf) == (int) sizeof buf,
+         "write \"%s\"", file_name);
+  freestat (&written);
+  CHECK (written.free == reserved.free, "write takes no more sectors");
+  msg ("close \"%s\"", file_name);
+  close (fd);
+  check_file (file_name, buf, sizeof buf);
+}
@@ -0,0 +1,21 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(prealloc) begin
+(prealloc) create "testfile"
+(prealloc) open "testfile"
+(prealloc) preallocate negative size fails
+(prealloc) preallocate "testfile"
+(prealloc) filesize "testfile" unchanged
+(prealloc) preallocate takes free sectors
+(prealloc) write "testfile"
+(prealloc) write takes no more sectors
+(prealloc) close "testfile"
+(prealloc) open "testfile" for verification
+(prealloc) verified contents of "testfile"
+(prealloc) close "testfile"
+(prealloc) end
+EOF
+pass;
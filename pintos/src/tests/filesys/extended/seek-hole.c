@@ -0,0 +1,33 @@
+/* Writes a single byte far past the start of an empty file and
+   checks that seekdata and seekhole find the sector that holds it
+   and the hole before it, and that they refuse negative
+   positions. */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+static char buf[10001];
+
+void
+test_main (void) 
+{
+  const char *file_name = "testfile";
+  int fd;
+
+  buf[10000] = 'x';
+  CHECK (create (file_name, 0), "create \"%s\"", file_name);
+  CHECK ((fd = open (file_name)) > 1, "open \"%s\"", file_name);
+  msg ("seek \"%s\"", file_name);
+  seek (fd, 10000);
+  CHECK (write (fd, buf + 10000, 1) == 1, "write \"%s\"", file_name);
+  CHECK (seekhole (fd, 0) == 0, "seekhole from 0");
+  CHECK (seekdata (fd, 0) == 9728, "seekdata from 0");
+  CHECK (seekhole (fd, 9728) == 10001, "seekhole from 9728");
+  CHECK (seekdata (fd, 10001) == 10001, "seekdata from end of file");
+  CHECK (seekdata (fd, -1) == -1, "seekdata from negative position fails");
+  CHECK (seekhole (fd, -1) == -1, "seekhole from negative position fails");
+  msg ("close \"%s\"", file_name);
+  close (fd);
+  check_file (file_name, buf, sizeof buf);
+}
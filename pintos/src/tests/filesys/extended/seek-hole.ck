@@ -0,0 +1,23 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(seek-hole) begin
+(seek-hole) create "testfile"
+(seek-hole) open "testfile"
+(seek-hole) seek "testfile"
+(seek-hole) write "testfile"
+(seek-hole) seekhole from 0
+(seek-hole) seekdata from 0
+(seek-hole) seekhole from 9728
+(seek-hole) seekdata from end of file
+(seek-hole) seekdata from negative position fails
+(seek-hole) seekhole from negative position fails
+(seek-hole) close "testfile"
+(seek-hole) open "testfile" for verification
+(seek-hole) verified contents of "testfile"
+(seek-hole) close "testfile"
+(seek-hole) end
+EOF
+pass;
@@ -0,0 +1,8 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+use tests::random;
+check_archive ({"child-syn-rng" => "tests/filesys/extended/child-syn-rng",
+		"data" => [random_bytes (2 * (2 * 4096 + 300))]});
+pass;
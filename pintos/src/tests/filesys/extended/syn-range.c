@@ -0,0 +1,33 @@
+/* Spawns two child processes that each write and read back their
+   own part of one file, over and over, at the same time.  Then
+   reads back the file and verifies its contents. */
+
+#include <random.h>
+#include <syscall.h>
+#include "tests/filesys/extended/syn-range.h"
+#include "tests/lib.h"
+#include "tests/main.h"
+
+static char buf1[BUF_SIZE];
+static char buf2[BUF_SIZE];
+
+void
+test_main (void) 
+{
+  pid_t children[CHILD_CNT];
+  int fd;
+
+  CHECK (create (file_name, 0), "create \"%s\"", file_name);
+
+  exec_children ("child-syn-rng", children, CHILD_CNT);
+  wait_children (children, CHILD_CNT);
+
+  CHECK ((fd = open (file_name)) > 1, "open \"%s\"", file_name);
+  CHECK (filesize (fd) == BUF_SIZE, "filesize \"%s\"", file_name);
+  CHECK (read (fd, buf1, sizeof buf1) == BUF_SIZE, "read \"%s\"",
+         file_name);
+  random_bytes (buf2, sizeof buf2);
+  compare_bytes (buf1, buf2, sizeof buf1, 0, file_name);
+  msg ("close \"%s\"", file_name);
+  close (fd);
+}
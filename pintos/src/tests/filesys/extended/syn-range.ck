@@ -0,0 +1,18 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(syn-range) begin
+(syn-range) create "data"
+(syn-range) exec child 1 of 2: "child-syn-rng 0"
+(syn-range) exec child 2 of 2: "child-syn-rng 1"
+(syn-range) wait for child 1 of 2 returned 0 (expected 0)
+(syn-range) wait for child 2 of 2 returned 1 (expected 1)
+(syn-range) open "data"
+(syn-range) filesize "data"
+(syn-range) read "data"
+(syn-range) close "data"
+(syn-range) end
+EOF
+pass;
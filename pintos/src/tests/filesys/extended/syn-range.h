@@ -0,0 +1,12 @@
+#ifndef TESTS_FILESYS_EXTENDED_SYN_RANGE_H
+#define TESTS_FILESYS_EXTENDED_SYN_RANGE_H
+
+/* Each child's part of the file is larger than a page and does not
+   start or end on a sector boundary, so neighbours share a sector. */
+#define CHILD_CNT 2
+#define CHUNK_SIZE (2 * 4096 + 300)
+#define BUF_SIZE (CHILD_CNT * CHUNK_SIZE)
+#define WRITE_CNT 10
+static const char file_name[] = "data";
+
+#endif /* tests/filesys/extended/syn-range.h */
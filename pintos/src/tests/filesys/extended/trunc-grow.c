@@ -0,0 +1,32 @@
+/* Truncates a file to fewer bytes and then to more, and checks that
+   the bytes past the shorter end read as zeros afterward, both in
+   the sector that held the old end and in the blocks never
+   written. */
+
+#include <random.h>
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+static char buf[3000];
+
+void
+test_main (void) 
+{
+  const char *file_name = "testfile";
+  int fd;
+
+  random_bytes (buf, 1000);
+  CHECK (create (file_name, 0), "create \"%s\"", file_name);
+  CHECK ((fd = open (file_name)) > 1, "open \"%s\"", file_name);
+  CHECK (write (fd, buf, 1000) == 1000, "write \"%s\"", file_name);
+  CHECK (truncate (fd, 600), "truncate \"%s\" to 600 bytes", file_name);
+  CHECK (truncate (fd, sizeof buf), "truncate \"%s\" to 3000 bytes",
+         file_name);
+  CHECK (filesize (fd) == (int) sizeof buf, "filesize \"%s\"", file_name);
+  msg ("close \"%s\"", file_name);
+  close (fd);
+  memset (buf + 600, 0, sizeof buf - 600);
+  check_file (file_name, buf, sizeof buf);
+}
@@ -0,0 +1,304 @@
+/* Runs filesys/directory.c and filesys/dcache.c on the host over
+   inodes kept in memory: a directory grown past its index, lookups
+   before and after removing half of its entries, reading it back,
+   emptiness, subdirectories, and the directory entry cache after
+   entries and directories go away. Every inode the directory code
+   opens must be closed again. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <debug.h>
+#include "filesys/dcache.h"
+#include "filesys/directory.h"
+#include "filesys/filesys.h"
+#include "filesys/inode.h"
+
+/* Number of entries in the big directory. */
+#define ENTRY_CNT 1500
+/* Sectors of the files in it. */
+#define FILE_SECTOR 100
+/* Sector of a subdirectory. */
+#define SUBDIR_SECTOR 50
+
+#define SECTOR_CNT (FILE_SECTOR + ENTRY_CNT)
+
+/* An inode kept in memory. */
+struct inode
+  {
+    disk_sector_t sector;
+    bool created;               /* Does it exist? */
+    bool removed;               /* Removed, freed at the last close? */
+    int open_cnt;
+    uint32_t type;
+    uint8_t *data;
+    off_t length;
+  };
+
+static struct inode inodes[SECTOR_CNT];
+
+/* The inode functions directory.c and dcache.c call. */
+
+bool
+inode_create (disk_sector_t sector, off_t length, uint32_t type)
+{
+  struct inode *inode = &inodes[sector];
+  ASSERT (sector < SECTOR_CNT);
+  ASSERT (!inode->created);
+  inode->sector = sector;
+  inode->created = true;
+  inode->removed = false;
+  inode->type = type;
+  inode->data = calloc (1, length > 0 ? length : 1);
+  inode->length = length;
+  return inode->data != NULL;
+}
+
+struct inode *
+inode_open (disk_sector_t sector)
+{
+  struct inode *inode = &inodes[sector];
+  ASSERT (sector < SECTOR_CNT);
+  if (!inode->created || inode->removed)
+    return NULL;
+  inode->open_cnt++;
+  return inode;
+}
+
+struct inode *
+inode_reopen (struct inode *inode)
+{
+  if (inode != NULL)
+    inode->open_cnt++;
+  return inode;
+}
+
+disk_sector_t
+inode_get_inumber (const struct inode *inode)
+{
+  return inode->sector;
+}
+
+void
+inode_close (struct inode *inode)
+{
+  if (inode == NULL)
+    return;
+  ASSERT (inode->open_cnt > 0);
+  if (--inode->open_cnt == 0 && inode->removed)
+    {
+      free (inode->data);
+      inode->data = NULL;
+      inode->created = false;
+    }
+}
+
+void
+inode_remove (struct inode *inode)
+{
+  inode->removed = true;
+}
+
+void inode_lock (struct inode *inode) { (void) inode; }
+void inode_unlock (struct inode *inode) { (void) inode; }
+void inode_dir_lock (struct inode *inode) { (void) inode; }
+void inode_dir_unlock (struct inode *inode) { (void) inode; }
+
+off_t
+inode_read_at (struct inode *inode, void *buffer, off_t size, off_t offset)
+{
+  if (offset >= inode->length)
+    return 0;
+  if (size > inode->length - offset)
+    size = inode->length - offset;
+  memcpy (buffer, inode->data + offset, size);
+  return size;
+}
+
+off_t
+inode_write_at (struct inode *inode, const void *buffer, off_t size,
+                off_t offset)
+{
+  if (offset + size > inode->length)
+    {
+      uint8_t *data = realloc (inode->data, offset + size);
+      ASSERT (data != NULL);
+      memset (data + inode->length, 0, offset + size - inode->length);
+      inode->data = data;
+      inode->length = offset + size;
+    }
+  memcpy (inode->data + offset, buffer, size);
+  return size;
+}
+
+off_t
+inode_length (const struct inode *inode)
+{
+  return inode->length;
+}
+
+bool
+inode_is_opened (struct inode *inode)
+{
+  return inode->open_cnt != 1;
+}
+
+bool
+inode_is_removed (struct inode *inode)
+{
+  return inode->removed;
+}
+
+/* The test. */
+
+static void
+fail (const char *what, int i)
+{
+  printf ("dir-index: %s (%d)\n", what, i);
+  exit (1);
+}
+
+static const char *
+file_name (int i)
+{
+  static char name[NAME_MAX + 1];
+  snprintf (name, sizeof name, "f%d", i);
+  return name;
+}
+
+/* Looks up NAME in DIR and returns its sector, or -1 if it is not
+   there. */
+static int
+lookup (struct dir *dir, const char *name, bool *is_dir)
+{
+  struct inode *inode;
+  bool dummy;
+  int sector;
+  if (!dir_lookup (dir, name, &inode, is_dir != NULL ? is_dir : &dummy))
+    return -1;
+  if (inode == NULL)
+    return -2;
+  sector = inode->sector;
+  inode_close (inode);
+  return sector;
+}
+
+int
+main (void)
+{
+  char name[NAME_MAX + 1];
+  struct dir *root, *dir, *sub;
+  bool is_dir;
+  int i, cnt;
+
+  dcache_init ();
+  if (!dir_create (ROOT_DIR_SECTOR, ROOT_DIR_SECTOR, 16))
+    fail ("dir_create root", 0);
+  root = dir_open_root ();
+
+  /* Enough entries that the directory gets an index. */
+  for (i = 0; i < ENTRY_CNT; i++)
+    {
+      inode_create (FILE_SECTOR + i, 0, TYPE_FILE);
+      if (!dir_add (root, file_name (i), false, FILE_SECTOR + i))
+        fail ("dir_add", i);
+    }
+  if (dir_add (root, file_name (7), false, FILE_SECTOR + 7))
+    fail ("dir_add of an existing name", 7);
+  for (i = 0; i < ENTRY_CNT; i++)
+    if (lookup (root, file_name (i), &is_dir) != FILE_SECTOR + i || is_dir)
+      fail ("lookup", i);
+  if (lookup (root, "nope", NULL) != -1)
+    fail ("lookup of a missing name", 0);
+  if (lookup (root, ".", NULL) != ROOT_DIR_SECTOR
+      || lookup (root, "..", NULL) != ROOT_DIR_SECTOR)
+    fail ("lookup of . or ..", 0);
+
+  /* Remove every other entry. */
+  for (i = 0; i < ENTRY_CNT; i += 2)
+    if (!dir_remove (root, file_name (i)))
+      fail ("dir_remove", i);
+  if (dir_remove (root, file_name (0)))
+    fail ("dir_remove of a removed name", 0);
+  for (i = 0; i < ENTRY_CNT; i++)
+    if (lookup (root, file_name (i), NULL)
+        != (i % 2 ? FILE_SECTOR + i : -1))
+      fail ("lookup after dir_remove", i);
+
+  /* Read it back through a fresh handle. */
+  dir = dir_open_root ();
+  for (cnt = 0; dir_readdir (dir, name); cnt++)
+    {
+      i = atoi (name + 1);
+      if (name[0] != 'f' || i % 2 == 0 || strcmp (name, file_name (i)))
+        fail ("dir_readdir returned a removed entry", i);
+    }
+  if (cnt != ENTRY_CNT / 2)
+    fail ("dir_readdir count", cnt);
+  dir_close (dir);
+
+  dir = dir_open_root ();
+  if (dir_is_empty (dir))
+    fail ("dir_is_empty with entries", 0);
+  dir_close (dir);
+  for (i = 1; i < ENTRY_CNT; i += 2)
+    if (!dir_remove (root, file_name (i)))
+      fail ("dir_remove", i);
+  dir = dir_open_root ();
+  if (!dir_is_empty (dir))
+    fail ("dir_is_empty without entries", 0);
+  dir_close (dir);
+
+  /* Reusing a removed name must not find the cached absence. */
+  inode_create (FILE_SECTOR + 1, 0, TYPE_FILE);
+  if (!dir_add (root, "zz", false, FILE_SECTOR + 1)
+      || lookup (root, "zz", NULL) != FILE_SECTOR + 1)
+    fail ("lookup after dir_add of a removed name", 0);
+  if (!dir_remove (root, "zz") || lookup (root, "zz", NULL) != -1)
+    fail ("lookup after dir_remove", 0);
+
+  /* A subdirectory is removed only when empty and not open, and
+     nothing is cached in it once it is gone. */
+  if (!dir_create (SUBDIR_SECTOR, ROOT_DIR_SECTOR, 16)
+      || !dir_add (root, "sub", true, SUBDIR_SECTOR))
+    fail ("dir_create sub", 0);
+  if (lookup (root, "sub", &is_dir) != SUBDIR_SECTOR || !is_dir)
+    fail ("lookup sub", 0);
+  sub = dir_open (inode_open (SUBDIR_SECTOR));
+  inode_create (FILE_SECTOR + 2, 0, TYPE_FILE);
+  if (!dir_add (sub, "a", false, FILE_SECTOR + 2)
+      || lookup (sub, "a", NULL) != FILE_SECTOR + 2
+      || lookup (sub, "..", NULL) != ROOT_DIR_SECTOR)
+    fail ("lookup in sub", 0);
+  dir_close (sub);
+  if (dir_remove (root, "sub"))
+    fail ("dir_remove of a directory with entries", 0);
+  sub = dir_open (inode_open (SUBDIR_SECTOR));
+  if (!dir_remove (sub, "a"))
+    fail ("dir_remove in sub", 0);
+  if (dir_remove (root, "sub"))
+    fail ("dir_remove of an open directory", 0);
+  dir_close (sub);
+  sub = dir_open (inode_open (SUBDIR_SECTOR));
+  dir_close (sub);
+  if (!dir_remove (root, "sub") || lookup (root, "sub", NULL) != -1)
+    fail ("dir_remove sub", 0);
+
+  /* The same sector used again for a new directory starts out with
+     nothing cached. */
+  if (!dir_create (SUBDIR_SECTOR, ROOT_DIR_SECTOR, 16)
+      || !dir_add (root, "sub2", true, SUBDIR_SECTOR))
+    fail ("dir_create sub2", 0);
+  sub = dir_open (inode_open (SUBDIR_SECTOR));
+  if (lookup (sub, "a", NULL) != -1)
+    fail ("stale entry in a new directory", 0);
+  dir_close (sub);
+
+  dir_close (root);
+  for (i = 0; i < SECTOR_CNT; i++)
+    if (inodes[i].open_cnt != 0)
+      fail ("inode left open", i);
+
+  printf ("dir-index: ok\n");
+  return 0;
+}
@@ -0,0 +1,374 @@
+/* Runs filesys/free-map.c on the host against a plain array of bits
+   that is searched one sector at a time: random allocations,
+   allocations near a goal and at a given sector, and releases must
+   pick the same sectors, and the free space statistics, the emptiest
+   allocation group and the free map file written by free_map_flush
+   must agree with the array.
+
+   The first argument is the number of sectors on the disk. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <bitmap.h>
+#include <debug.h>
+#include <round.h>
+#include "filesys/file.h"
+#include "filesys/filesys.h"
+#include "filesys/free-map.h"
+#include "filesys/inode.h"
+
+/* Number of allocation groups, as in free-map.c. */
+#define FREE_MAP_GROUPS 8
+/* Sectors a leaf of the free index covers, as in free-map.c. */
+#define FREE_INDEX_LEAF 32
+
+static size_t size;             /* Sectors on the disk. */
+static bool *used;              /* Model of the free map. */
+static size_t cursor;           /* Model of the allocation cursor. */
+
+/* Allocated runs, so that they can be released. */
+struct run
+  {
+    disk_sector_t start;
+    size_t cnt;
+  };
+static struct run *runs;
+static size_t run_cnt;
+
+/* The free map file. */
+static uint8_t *image;
+static off_t image_size;
+static bool fail_writes;        /* Make file_write_at fail? */
+
+/* Disk and file system services free-map.c calls. */
+
+struct disk *filesys_disk;
+
+disk_sector_t
+disk_size (struct disk *disk)
+{
+  (void) disk;
+  return size;
+}
+
+bool
+inode_create (disk_sector_t sector, off_t length, uint32_t type)
+{
+  ASSERT (sector == FREE_MAP_SECTOR);
+  ASSERT (type == TYPE_FILE);
+  image = calloc (1, length);
+  image_size = length;
+  return image != NULL;
+}
+
+struct inode *
+inode_open (disk_sector_t sector)
+{
+  ASSERT (sector == FREE_MAP_SECTOR);
+  return (struct inode *) &image;
+}
+
+struct file *
+file_open (struct inode *inode)
+{
+  return (struct file *) inode;
+}
+
+void
+file_close (struct file *file)
+{
+  (void) file;
+}
+
+off_t
+file_read_at (struct file *file, void *buffer, off_t size, off_t start)
+{
+  (void) file;
+  ASSERT (start >= 0 && start + size <= image_size);
+  memcpy (buffer, image + start, size);
+  return size;
+}
+
+off_t
+file_write_at (struct file *file, const void *buffer, off_t size,
+               off_t start)
+{
+  (void) file;
+  ASSERT (start >= 0 && start + size <= image_size);
+  if (fail_writes)
+    return 0;
+  memcpy (image + start, buffer, size);
+  return size;
+}
+
+/* The model. */
+
+static void
+fail (const char *what, unsigned long a, unsigned long b)
+{
+  printf ("free-index: %lu sectors: %s: got %lu, expected %lu\n",
+          (unsigned long) size, what, a, b);
+  exit (1);
+}
+
+/* Returns true if the CNT sectors starting at START are free. */
+static bool
+model_free (size_t start, size_t cnt)
+{
+  size_t i;
+  for (i = start; i < start + cnt; i++)
+    if (used[i])
+      return false;
+  return true;
+}
+
+static void
+model_set (size_t start, size_t cnt, bool value)
+{
+  size_t i;
+  for (i = start; i < start + cnt; i++)
+    used[i] = value;
+}
+
+/* Returns the first run of CNT free sectors at or after GOAL, or the
+   first one on the disk if there is none, or BITMAP_ERROR. */
+static size_t
+model_scan (size_t cnt, size_t goal)
+{
+  size_t i;
+  for (i = goal; i + cnt <= size; i++)
+    if (model_free (i, cnt))
+      return i;
+  for (i = 0; i + cnt <= size; i++)
+    if (model_free (i, cnt))
+      return i;
+  return BITMAP_ERROR;
+}
+
+static void
+remember (disk_sector_t start, size_t cnt)
+{
+  runs[run_cnt].start = start;
+  runs[run_cnt].cnt = cnt;
+  run_cnt++;
+}
+
+/* Returns a run length, mostly short ones. */
+static size_t
+random_cnt (void)
+{
+  switch (rand () % 4)
+    {
+    case 0:
+      return 1;
+    case 1:
+      return 1 + rand () % 8;
+    case 2:
+      return 1 + rand () % 64;
+    default:
+      return 1 + rand () % (size / 8);
+    }
+}
+
+static void
+do_allocate (void)
+{
+  size_t cnt = random_cnt ();
+  size_t expected = model_scan (cnt, cursor < size ? cursor : size);
+  disk_sector_t sector;
+  bool success = free_map_allocate (cnt, &sector);
+  if (success != (expected != BITMAP_ERROR))
+    fail ("free_map_allocate success", success, expected != BITMAP_ERROR);
+  if (success)
+    {
+      if (sector != expected)
+        fail ("free_map_allocate", sector, expected);
+      model_set (sector, cnt, true);
+      remember (sector, cnt);
+      cursor = sector + cnt;
+    }
+}
+
+static void
+do_allocate_near (void)
+{
+  size_t cnt = random_cnt ();
+  size_t goal = rand () % (size + size / 16);
+  size_t expected = model_scan (cnt, goal < size ? goal : size);
+  disk_sector_t sector;
+  bool success = free_map_allocate_near (cnt, goal, &sector);
+  if (success != (expected != BITMAP_ERROR))
+    fail ("free_map_allocate_near success", success,
+          expected != BITMAP_ERROR);
+  if (success)
+    {
+      if (sector != expected)
+        fail ("free_map_allocate_near", sector, expected);
+      model_set (sector, cnt, true);
+      remember (sector, cnt);
+    }
+}
+
+static void
+do_allocate_at (void)
+{
+  size_t cnt = random_cnt ();
+  size_t sector = rand () % size;
+  bool expected = sector + cnt <= size && model_free (sector, cnt);
+  bool success = free_map_allocate_at (sector, cnt);
+  if (success != expected)
+    fail ("free_map_allocate_at", success, expected);
+  if (success)
+    {
+      model_set (sector, cnt, true);
+      remember (sector, cnt);
+    }
+}
+
+static void
+do_release (void)
+{
+  size_t i;
+  if (run_cnt == 0)
+    return;
+  i = rand () % run_cnt;
+  free_map_release (runs[i].start, runs[i].cnt);
+  model_set (runs[i].start, runs[i].cnt, false);
+  runs[i] = runs[--run_cnt];
+}
+
+/* Checks the statistics and the emptiest group against the model. */
+static void
+check_stats (void)
+{
+  struct free_map_stats stats;
+  size_t free = 0, free_runs = 0, largest = 0, run = 0;
+  size_t group = ROUND_UP (DIV_ROUND_UP (size, FREE_MAP_GROUPS),
+                           FREE_INDEX_LEAF);
+  size_t best = 0, best_free = 0;
+  size_t start, i;
+
+  for (i = 0; i < size; i++)
+    if (!used[i])
+      {
+        free++;
+        if (run++ == 0)
+          free_runs++;
+        if (run > largest)
+          largest = run;
+      }
+    else
+      run = 0;
+
+  free_map_get_stats (&stats);
+  if (stats.sectors != size)
+    fail ("sectors", stats.sectors, size);
+  if (stats.free != free)
+    fail ("free", stats.free, free);
+  if (stats.free_runs != free_runs)
+    fail ("free_runs", stats.free_runs, free_runs);
+  if (stats.largest_run != largest)
+    fail ("largest_run", stats.largest_run, largest);
+
+  for (start = 0; start < size; start += group)
+    {
+      size_t group_free = 0;
+      for (i = start; i < start + group && i < size; i++)
+        group_free += !used[i];
+      if (group_free > best_free)
+        {
+          best = start;
+          best_free = group_free;
+        }
+    }
+  if (free_map_emptiest_group () != best)
+    fail ("free_map_emptiest_group", free_map_emptiest_group (), best);
+}
+
+/* Checks that the free map file matches the model. */
+static void
+check_image (void)
+{
+  size_t i;
+  for (i = 0; i < size; i++)
+    if (((image[i / 8] >> (i % 8)) & 1) != used[i])
+      fail ("free map file bit", i, used[i]);
+}
+
+int
+main (int argc, char *argv[])
+{
+  int op;
+
+  size = argc > 1 ? strtoul (argv[1], NULL, 10) : 20160;
+  ASSERT (size >= 64);
+  srand (size);
+  used = calloc (size, sizeof *used);
+  runs = calloc (size, sizeof *runs);
+  ASSERT (used != NULL && runs != NULL);
+
+  free_map_init ();
+  free_map_create ();
+  used[FREE_MAP_SECTOR] = used[ROOT_DIR_SECTOR] = true;
+  check_stats ();
+  check_image ();
+
+  for (op = 0; op < 20000; op++)
+    {
+      switch (rand () % 5)
+        {
+        case 0:
+          do_allocate ();
+          break;
+        case 1:
+          do_allocate_near ();
+          break;
+        case 2:
+          do_allocate_at ();
+          break;
+        default:
+          do_release ();
+          break;
+        }
+      if (op % 97 == 0)
+        check_stats ();
+      if (op % 250 == 0)
+        {
+          /* A failed write leaves the sectors dirty for the next. */
+          fail_writes = rand () % 3 == 0;
+          free_map_flush ();
+          if (!fail_writes)
+            check_image ();
+          fail_writes = false;
+        }
+    }
+  check_stats ();
+  free_map_close ();
+  check_image ();
+
+  /* Reading the free map back rebuilds the index from the file. */
+  model_set (size / 3, size / 4, false);
+  for (op = 0; op < (int) size / 3; op++)
+    {
+      size_t i = rand () % size;
+      used[i] = !used[i];
+    }
+  used[FREE_MAP_SECTOR] = used[ROOT_DIR_SECTOR] = true;
+  memset (image, 0, image_size);
+  for (op = 0; op < (int) size; op++)
+    if (used[op])
+      image[op / 8] |= 1 << (op % 8);
+  free_map_open ();
+  check_stats ();
+  run_cnt = 0;
+  for (op = 0; op < 2000; op++)
+    if (rand () % 2)
+      do_allocate_near ();
+    else
+      do_allocate_at ();
+  check_stats ();
+
+  printf ("free-index: %lu sectors: ok\n", (unsigned long) size);
+  return 0;
+}
@@ -0,0 +1,9 @@
+/* Included first in every file of the host build. It supplies what
+   the kernel's C library headers provide and the host's do not. */
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <debug.h>
+
+size_t strlcpy (char *, const char *, size_t);
+void hex_dump (uintptr_t ofs, const void *, size_t size, bool ascii);
@@ -0,0 +1,74 @@
+/* Kernel services the file system code calls, for the host build. */
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <debug.h>
+#include "threads/synch.h"
+#include "threads/thread.h"
+
+void
+debug_panic (const char *file, int line, const char *function,
+             const char *message, ...)
+{
+  va_list args;
+  printf ("PANIC at %s:%d in %s(): ", file, line, function);
+  va_start (args, message);
+  vprintf (message, args);
+  va_end (args);
+  printf ("\n");
+  abort ();
+}
+
+size_t
+strlcpy (char *dst, const char *src, size_t size)
+{
+  size_t src_len = strlen (src);
+  if (size > 0)
+    {
+      size_t dst_len = src_len < size - 1 ? src_len : size - 1;
+      memcpy (dst, src, dst_len);
+      dst[dst_len] = '\0';
+    }
+  return src_len;
+}
+
+void
+hex_dump (uintptr_t ofs, const void *buf, size_t size, bool ascii)
+{
+  const unsigned char *p = buf;
+  size_t i;
+  (void) ofs;
+  (void) ascii;
+  for (i = 0; i < size; i++)
+    printf ("%s%02x", i % 16 == 0 ? (i ? "\n" : "") : " ", p[i]);
+  printf ("\n");
+}
+
+void
+lock_init (struct lock *lock)
+{
+  lock->held = 0;
+}
+
+void
+lock_acquire (struct lock *lock)
+{
+  ASSERT (lock->held == 0);
+  lock->held = 1;
+}
+
+void
+lock_release (struct lock *lock)
+{
+  ASSERT (lock->held == 1);
+  lock->held = 0;
+}
+
+struct thread *
+thread_current (void)
+{
+  static struct thread thread;
+  return &thread;
+}
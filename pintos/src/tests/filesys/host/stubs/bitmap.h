@@ -0,0 +1,2 @@
+/* Host build: the real header. */
+#include "../../../../lib/kernel/bitmap.h"
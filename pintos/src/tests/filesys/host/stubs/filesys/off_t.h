@@ -0,0 +1,10 @@
+#ifndef FILESYS_OFF_T_H
+#define FILESYS_OFF_T_H
+
+/* Host build: the host C library defines off_t itself. */
+#include <sys/types.h>
+#include <inttypes.h>
+
+#define PROTd "jd"
+
+#endif /* filesys/off_t.h */
@@ -0,0 +1,7 @@
+#ifndef THREADS_MALLOC_H
+#define THREADS_MALLOC_H
+
+/* Host build: the host allocator. */
+#include <stdlib.h>
+
+#endif /* threads/malloc.h */
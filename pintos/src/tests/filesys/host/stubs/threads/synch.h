@@ -0,0 +1,15 @@
+#ifndef THREADS_SYNCH_H
+#define THREADS_SYNCH_H
+
+/* Host build: the harnesses are single threaded, so a lock only
+   counts how many times it is held, which must be at most once. */
+struct lock
+  {
+    int held;
+  };
+
+void lock_init (struct lock *);
+void lock_acquire (struct lock *);
+void lock_release (struct lock *);
+
+#endif /* threads/synch.h */
@@ -0,0 +1,14 @@
+#ifndef THREADS_THREAD_H
+#define THREADS_THREAD_H
+
+#include "devices/disk.h"
+
+/* Host build: only what the file system code looks at. */
+struct thread
+  {
+    disk_sector_t curr_dir_sector;      /* Current directory. */
+  };
+
+struct thread *thread_current (void);
+
+#endif /* threads/thread.h */
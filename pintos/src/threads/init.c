@@ -35,7 +35,9 @@
 #endif
 #ifdef FILESYS
 #include "devices/disk.h"
+#include "filesys/cache.h"
 #include "filesys/filesys.h"
+#include "filesys/free-map.h"
 #include "filesys/fsutil.h"
 #endif
 
@@ -248,6 +250,10 @@ parse_options (char **argv)
 #ifdef FILESYS
       else if (!strcmp (name, "-f"))
         format_filesys = true;
+      else if (!strcmp (name, "-bc"))
+        buffer_cache_size = atoi (value);
+      else if (!strcmp (name, "-bcp"))
+        buffer_cache_policy = value;
 #endif
       else if (!strcmp (name, "-rs"))
         random_init (atoi (value));
@@ -356,6 +362,11 @@ usage (void)
           "  -h                 Print this help message and power off.\n"
           "  -q                 Power off VM after actions or on panic.\n"
           "  -f                 Format file system disk during startup.\n"
+#ifdef FILESYS
+          "  -bc=COUNT          Cache COUNT disk sectors in memory.\n"
+          "  -bcp=POLICY        Use buffer cache replacement POLICY:\n"
+          "                     clock (default), lru or 2q.\n"
+#endif
           "  -rs=SEED           Set random number seed to SEED.\n"
           "  -mlfqs             Use multi-level feedback queue scheduler.\n"
 #ifdef USERPROG
@@ -398,6 +409,8 @@ print_stats (void)
   thread_print_stats ();
 #ifdef FILESYS
   disk_print_stats ();
+  buffer_cache_print_stats ();
+  free_map_print_stats ();
 #endif
   console_print_stats ();
   kbd_print_stats ();
@@ -4,9 +4,11 @@
 #include <string.h>
 #include <syscall-nr.h>
 #include "devices/input.h"
+#include "filesys/cache.h"
 #include "filesys/directory.h"
 #include "filesys/file.h"
 #include "filesys/filesys.h"
+#include "filesys/free-map.h"
 #include "threads/init.h"
 #include "threads/interrupt.h"
 #include "threads/malloc.h"
@@ -14,9 +16,13 @@
 #include "threads/thread.h"
 #include "threads/vaddr.h"
 #include "userprog/process.h"
+#include "vm/frame.h"
 #include "vm/page.h"
 
 #define WRITEBATCH 1024
+/* Largest part of a user buffer pinned in memory at once. Reads and
+ * writes of files up to this size are atomic. */
+#define PINBATCH (64 * PGSIZE)
 
 /* Map region identifier. */
 typedef int mapid_t;
@@ -58,11 +64,14 @@ static struct mapid_elem * find_mapid (mapid_t mapid);
 static void munmap_loop (struct mapid_elem * elem);
 static void syscall_handler (struct intr_frame *);
 
+static void syscall_cachestat (struct cache_stats * stats);
 static uint32_t syscall_chdir (const char * dir);
 static void syscall_close (int fd);
 static uint32_t syscall_create (const char * file, size_t initial_size);
 static uint32_t syscall_exec (const char * cmd_line);
+static uint32_t syscall_fallocate (int fd, size_t offset, size_t length);
 static uint32_t syscall_filesize (int fd);
+static void syscall_freestat (struct free_map_stats * stats);
 static void syscall_halt (void) NO_RETURN;
 static uint32_t syscall_inumber (int fd);
 static uint32_t syscall_isdir (int fd);
@@ -70,11 +79,15 @@ static uint32_t syscall_mkdir (const char * dir);
 static uint32_t syscall_mmap (int fd, void * addr);
 static void syscall_munmap (mapid_t mapping);
 static uint32_t syscall_open (const char * file);
+static uint32_t syscall_preallocate (int fd, size_t size);
 static uint32_t syscall_read (int fd, void * buffer, size_t size);
 static uint32_t syscall_readdir (int fd, char * name);
 static uint32_t syscall_remove (const char * file);
 static void syscall_seek (int fd, size_t position);
+static uint32_t syscall_seekdata (int fd, size_t position);
+static uint32_t syscall_seekhole (int fd, size_t position);
 static uint32_t syscall_tell (int fd);
+static uint32_t syscall_truncate (int fd, size_t size);
 static uint32_t syscall_wait (pid_t pid);
 static uint32_t syscall_write (int fd, const void * buffer, size_t size);
 
@@ -179,6 +192,39 @@ is_valid_range_write (uint8_t * uaddr, size_t size)
   return is_valid_write (uaddr + size - 1);
 }
 
+/* Pins the pages from uaddr to uaddr + size - 1 in memory, faulting in
+ * those that are not, so that the file system can access them while
+ * holding its locks. Returns false if any of them is invalid, with no
+ * page left pinned. */
+static bool
+pin_range (const uint8_t * uaddr, size_t size)
+{
+  uint8_t * page;
+  uint8_t * end = pg_round_up (uaddr + size);
+  for (page = pg_round_down (uaddr); page < end; page += PGSIZE)
+    while (!pin_frame (page))
+      if (!is_valid (page < uaddr ? uaddr : page))
+      {
+        while (page > (uint8_t *) pg_round_down (uaddr))
+        {
+          page -= PGSIZE;
+          unpin_frame (page);
+        }
+        return false;
+      }
+  return true;
+}
+
+/* Unpins the pages pinned by pin_range. */
+static void
+unpin_range (const uint8_t * uaddr, size_t size)
+{
+  uint8_t * page;
+  uint8_t * end = pg_round_up (uaddr + size);
+  for (page = pg_round_down (uaddr); page < end; page += PGSIZE)
+    unpin_frame (page);
+}
+
 /* Handler of the system call. Find out what system call is called and
  * what the arguments are. Pass those arguments and execute the
  * appropriate system call. */
@@ -248,6 +294,12 @@ syscall_handler (struct intr_frame *f)
       case SYS_INUMBER:
         f->eax = syscall_inumber (arg1);
         break;
+      case SYS_CACHESTAT:
+        syscall_cachestat ((struct cache_stats *)arg1);
+        break;
+      case SYS_FREESTAT:
+        syscall_freestat ((struct free_map_stats *)arg1);
+        break;
       default:
         /* Check validity of the second argument. */
         if ((arg2 = get_long(esp++)) == -1) syscall_exit (KERNEL_TERMINATE);
@@ -267,6 +319,18 @@ syscall_handler (struct intr_frame *f)
           case SYS_READDIR:
             f->eax = syscall_readdir (arg1, (char *)arg2);
             break;
+          case SYS_SEEKDATA:
+            f->eax = syscall_seekdata (arg1, (size_t)arg2);
+            break;
+          case SYS_SEEKHOLE:
+            f->eax = syscall_seekhole (arg1, (size_t)arg2);
+            break;
+          case SYS_PREALLOCATE:
+            f->eax = syscall_preallocate (arg1, (size_t)arg2);
+            break;
+          case SYS_TRUNCATE:
+            f->eax = syscall_truncate (arg1, (size_t)arg2);
+            break;
           default:
             /* Check validity of third argument. */
             if ((arg3 = get_long(esp)) == -1) syscall_exit (KERNEL_TERMINATE);
@@ -280,6 +344,9 @@ syscall_handler (struct intr_frame *f)
               case SYS_WRITE:
                 f->eax = syscall_write (arg1, (const void *)arg2, (size_t)arg3);
                 break;
+              case SYS_FALLOCATE:
+                f->eax = syscall_fallocate (arg1, (size_t)arg2, (size_t)arg3);
+                break;
               default:
                 ASSERT (false);
             }
@@ -326,6 +393,17 @@ find_mapid (mapid_t mapid)
   return NULL;
 }
 
+/* Copies a snapshot of the buffer cache statistics to STATS. */
+static void
+syscall_cachestat (struct cache_stats * stats)
+{
+  struct cache_stats snapshot;
+  if (!is_valid_range_write ((uint8_t *) stats, sizeof *stats))
+    syscall_exit (KERNEL_TERMINATE);
+  buffer_cache_get_stats (&snapshot);
+  memcpy (stats, &snapshot, sizeof *stats);
+}
+
 /* Changes the current working directory. */
 static uint32_t
 syscall_chdir (const char * dir)
@@ -411,6 +489,21 @@ syscall_exit (int status)
   NOT_REACHED ();
 }
 
+/* Allocates disk space for length bytes of fd starting at offset,
+ * growing fd if they extend past its end. Returns false if fd is not an
+ * open file, the range is too large or the disk is full. */
+static uint32_t
+syscall_fallocate (int fd, size_t offset, size_t length)
+{
+  struct fd_elem * fd_elem = find_fd (fd);
+  if (fd_elem == NULL || fd_elem->type != TYPE_FILE)
+    return false;
+  if ((off_t) offset < 0 || (off_t) length < 0
+      || (off_t) (offset + length) < (off_t) offset)
+    return false;
+  return file_allocate (fd_elem->ptr.file, offset, length);
+}
+
 /* Returns the size of the fd in bytes. */
 static uint32_t
 syscall_filesize (int fd) 
@@ -423,6 +516,17 @@ syscall_filesize (int fd)
   return size;
 }
 
+/* Copies a snapshot of the free space statistics to STATS. */
+static void
+syscall_freestat (struct free_map_stats * stats)
+{
+  struct free_map_stats snapshot;
+  if (!is_valid_range_write ((uint8_t *) stats, sizeof *stats))
+    syscall_exit (KERNEL_TERMINATE);
+  free_map_get_stats (&snapshot);
+  memcpy (stats, &snapshot, sizeof *stats);
+}
+
 /* Terminates Pintos. */
 static void
 syscall_halt (void)
@@ -588,6 +692,20 @@ syscall_open (const char * file_name)
   return fd;
 }
 
+/* Allocates the disk space for the first size bytes of fd in advance,
+ * without changing its size. Returns false if fd is not an open file,
+ * writes to it are denied or the disk is full. */
+static uint32_t
+syscall_preallocate (int fd, size_t size)
+{
+  struct fd_elem * fd_elem = find_fd (fd);
+  if (fd_elem == NULL || fd_elem->type != TYPE_FILE)
+    return false;
+  if ((off_t) size < 0)
+    return false;
+  return file_reserve (fd_elem->ptr.file, size);
+}
+
 /* Reads size bytes from fd to buffer. Returns the number of bytes
  * actually read, or -1 if error occured. */
 static uint32_t
@@ -613,7 +731,22 @@ syscall_read (int fd, void * buffer, size_t size)
     else if (fd_elem->type != TYPE_FILE)
       nread = -1;
     else
-      nread = file_read (fd_elem->ptr.file, buffer, size);
+    {
+      /* The buffer is pinned while the file system copies into it. */
+      while (size > 0)
+      {
+        size_t chunk = size < PINBATCH ? size : PINBATCH;
+        if (!pin_range (usrbyte, chunk))
+          syscall_exit (KERNEL_TERMINATE);
+        int chunk_read = file_read (fd_elem->ptr.file, usrbyte, chunk);
+        unpin_range (usrbyte, chunk);
+        nread += chunk_read;
+        if ((size_t) chunk_read < chunk)
+          break;
+        usrbyte += chunk;
+        size -= chunk;
+      }
+    }
   }
   return nread;
 }
@@ -656,6 +789,35 @@ syscall_seek (int fd, size_t position)
       file_seek (fd_elem->ptr.file, position);
 }
 
+/* Returns the offset of the first byte at or after position in fd that
+ * is stored on disk, or the size of fd if there is none. Returns -1 if
+ * fd is not an open file or position is negative. */
+static uint32_t
+syscall_seekdata (int fd, size_t position)
+{
+  struct fd_elem * fd_elem = find_fd (fd);
+  if (fd_elem == NULL || fd_elem->type != TYPE_FILE)
+    return -1;
+  if ((off_t) position < 0)
+    return -1;
+  return inode_seek_data (file_get_inode (fd_elem->ptr.file), position);
+}
+
+/* Returns the offset of the first byte at or after position in fd that
+ * is in a hole, which reads as zero without being stored, or the size
+ * of fd if there is none. Returns -1 if fd is not an open file or
+ * position is negative. */
+static uint32_t
+syscall_seekhole (int fd, size_t position)
+{
+  struct fd_elem * fd_elem = find_fd (fd);
+  if (fd_elem == NULL || fd_elem->type != TYPE_FILE)
+    return -1;
+  if ((off_t) position < 0)
+    return -1;
+  return inode_seek_hole (file_get_inode (fd_elem->ptr.file), position);
+}
+
 /* Returns the position of the next byte to read or written in fd,
  * expressed in bytes from the beginning of the file. */
 static uint32_t
@@ -668,6 +830,20 @@ syscall_tell (int fd)
   return -1;
 }
 
+/* Sets the size of fd to size bytes, freeing the blocks past the new end
+ * if it shrinks. Returns false if fd is not an open file or writes to
+ * it are denied. */
+static uint32_t
+syscall_truncate (int fd, size_t size)
+{
+  struct fd_elem * fd_elem = find_fd (fd);
+  if (fd_elem == NULL || fd_elem->type != TYPE_FILE)
+    return false;
+  if ((off_t) size < 0)
+    return false;
+  return file_truncate (fd_elem->ptr.file, size);
+}
+
 /* Waits for pid to die and returns its status. Returns -1 if the pid
  * was terminated by the kernel. Returns -1 without waiting if the pid
  * is not a child of the process, or wait has already been successfully
@@ -722,7 +898,20 @@ syscall_write (int fd, const void * buffer, size_t size)
     else
     {
       off_t pos = file_tell (fd_elem->ptr.file);
-      nwrite = file_write (fd_elem->ptr.file, buffer, size);
+      /* The buffer is pinned while the file system copies from it. */
+      while (to_write > 0)
+      {
+        size_t chunk = to_write < PINBATCH ? to_write : PINBATCH;
+        if (!pin_range (usrbyte, chunk))
+          syscall_exit (KERNEL_TERMINATE);
+        int chunk_written = file_write (fd_elem->ptr.file, usrbyte, chunk);
+        unpin_range (usrbyte, chunk);
+        nwrite += chunk_written;
+        if ((size_t) chunk_written < chunk)
+          break;
+        usrbyte += chunk;
+        to_write -= chunk;
+      }
       /* If this file is mapped to a certain memory, edit that memory too. */
       if (fd_elem->mapid != NULL)
         memcpy (fd_elem->mapid->address + pos, buffer, nwrite);
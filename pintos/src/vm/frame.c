@@ -3,6 +3,7 @@
 #include "threads/malloc.h"
 #include "threads/synch.h"
 #include "threads/thread.h"
+#include "threads/vaddr.h"
 #include "userprog/pagedir.h"
 #include "vm/page.h"
 
@@ -59,6 +60,7 @@ add_frame (void * address, void * vaddr)
   fr->address = address;
   fr->holder = thread_current ();
   fr->vaddr = vaddr;
+  fr->pinned = false;
   lock_frame ();
   list_push_front (&frame_table, &fr->elem);
   unlock_frame ();
@@ -125,6 +127,8 @@ evict_loop (void * vaddr, struct frame * old)
         frame_curr = list_next (frame_curr))
     {
       victim = list_entry (frame_curr, struct frame, elem);
+      if (victim->pinned)
+        continue;
       /* Second chance algorithm. */
       if (pagedir_is_accessed (victim->holder->pagedir, victim->vaddr))
         pagedir_set_accessed (victim->holder->pagedir, victim->vaddr, false);
@@ -157,3 +161,56 @@ evict_frame (void * vaddr, struct frame * old)
   unlock_frame ();
 }
 
+
+/* Return the frame holding the page of the current thread at user
+ * virtual address VADDR, or NULL if the page is not in memory.
+ * frame_lock must be held. */
+static struct frame *
+find_frame (void * vaddr)
+{
+  struct thread * curr = thread_current ();
+  struct list_elem * elem;
+  void * address = pagedir_get_page (curr->pagedir, vaddr);
+  if (address == NULL)
+    return NULL;
+  for (elem = list_begin (&frame_table); elem != list_end (&frame_table);
+       elem = list_next (elem))
+    {
+      struct frame * fr = list_entry (elem, struct frame, elem);
+      /* The frame may have been taken by an eviction that has not
+       * cleared the page table yet. */
+      if (fr->address == address)
+        return fr->holder == curr && fr->vaddr == vaddr ? fr : NULL;
+    }
+  return NULL;
+}
+
+/* Pin the frame holding the page of the current thread at user
+ * virtual address VADDR, so that it is not evicted until unpin_frame
+ * is called, and the kernel can access the page without faulting.
+ * Returns false if the page is not in memory, in which case the caller
+ * should fault it in and try again. */
+bool
+pin_frame (void * vaddr)
+{
+  struct frame * fr;
+  ASSERT (pg_ofs (vaddr) == 0);
+  lock_frame ();
+  fr = find_frame (vaddr);
+  if (fr != NULL)
+    fr->pinned = true;
+  unlock_frame ();
+  return fr != NULL;
+}
+
+/* Unpin the frame pinned by pin_frame for VADDR. */
+void
+unpin_frame (void * vaddr)
+{
+  struct frame * fr;
+  lock_frame ();
+  fr = find_frame (vaddr);
+  ASSERT (fr != NULL);
+  fr->pinned = false;
+  unlock_frame ();
+}
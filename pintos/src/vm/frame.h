@@ -14,6 +14,7 @@ struct frame
     void * address;           /* the kernel virtual address of the frame */
     struct thread * holder;   /* holder of the frame. */
     void * vaddr;             /* the virtual address of the page. */
+    bool pinned;              /* never evicted if set. */
     struct list_elem elem;
   };
 
@@ -21,5 +22,7 @@ void init_frame (void);
 bool add_frame (void * address, void * vaddr);
 void delete_frame (void * address);
 void evict_frame (void * vaddr, struct frame * old);
+bool pin_frame (void * vaddr);
+void unpin_frame (void * vaddr);
 
 #endif  /* vm/frame.h */